@@ -7,6 +7,54 @@
 
 #include <SDL.h>
 
+// Where frames are drawn before they reach the screen texture.
+enum SDL2AuxFramebuffer {
+  SDL2AUX_COPY,  // A pixel buffer, copied to the texture by render()
+  SDL2AUX_LOCK   // The locked streaming texture itself, so nothing is copied
+                 // (and nothing is left for saveBMP())
+};
+
+// When finished frames are shown.
+enum SDL2AuxPresent {
+  SDL2AUX_VSYNC,    // Every frame, one per vertical blank
+  SDL2AUX_MAILBOX,  // The newest frame at each vertical blank; older ones are dropped
+  SDL2AUX_UNCAPPED, // The newest frame, as soon as possible
+  SDL2AUX_HEADLESS  // Never: there is no window and SDL video is not started
+};
+
+// How render() brings frames drawn into a pixel buffer to the screen
+// texture.
+enum SDL2AuxUpload {
+  SDL2AUX_UPLOAD_FRAME,   // The whole frame, every time
+  SDL2AUX_UPLOAD_CHANGED  // Only the tiles that differ from the texture
+};
+
+// How HDR colors (see SDL2Aux::enableHDR) are brought into [0, 1].
+enum SDL2AuxToneMap {
+  SDL2AUX_CLAMP,     // Not at all: everything above 1 clips, as without HDR
+  SDL2AUX_REINHARD,  // c / (1 + c): soft highlights, never quite white
+  SDL2AUX_ACES       // A fit of the ACES filmic curve: contrasty, saturates to white
+};
+
+// clearPixels() works in tiles of SDL2AUX_CLEAR_TILE_SIZE pixels square,
+// which the put functions mark as written. Blocks may be written with
+// putTile() from several threads at once only if they are disjoint and
+// their corners lie on this tile grid (or the frame edge), so no two
+// threads touch the same tile.
+const int SDL2AUX_CLEAR_TILE_SHIFT = 4;
+const int SDL2AUX_CLEAR_TILE_SIZE = 1 << SDL2AUX_CLEAR_TILE_SHIFT;
+
+// Receives every frame passed to render(): width x height pixels of
+// 0xAARRGGBB, rows pitch bytes apart. The pixels are only valid during
+// the call.
+typedef void (*SDL2AuxFrameSink)(const Uint32 *pixels, int width, int height,
+  int pitch, void *user_data);
+
+// Runs first on every thread that SDL2Aux, SDL2ImageWriter and
+// SDL2VideoWriter start, given the thread's name, e.g. to leave the
+// thread out of per-frame statistics.
+typedef void (*SDL2AuxThreadHook)(const char *name);
+
 class SDL2Aux {
   private:
     int width;
@@ -17,23 +65,122 @@ class SDL2Aux {
     SDL_Texture *sdl_texture = NULL;
     SDL_Window *sdl_window = NULL;
 
-    Uint32 *pixel_buffer = NULL;
+    Uint32 *pixel_buffer = NULL;  // The one of buffers being drawn
+
+    SDL2AuxFramebuffer framebuffer;
+    Uint32 *frame = NULL;  // Pixel (x, y) is frame[y * frame_stride + x]
+    int frame_stride = 0;
+
+    // With more than one buffer, frames are presented on a thread of
+    // their own, which owns the window, renderer and texture and pumps
+    // the window's events. Buffers move from drawing to ready to spare,
+    // guarded by present_mutex, as is the window title to set.
+    SDL2AuxPresent present;
+    int buffer_count = 1;
+    Uint32 *buffers[3] = {NULL, NULL, NULL};
+    int drawing = 0;
+    int finished = 0;      // The last frame handed to render()
+    int ready[3];          // Waiting to be presented, oldest first
+    int ready_count = 0;
+    int spare[3];          // Free for drawing
+    int spare_count = 0;
+    bool present_quit = false;
+    int present_status = 0;  // 1 once the present thread runs, -1 if it failed
+    SDL_Thread *present_thread = NULL;
+    SDL_mutex *present_mutex = NULL;
+    SDL_cond *present_cond = NULL;
+    char window_title[256];
+    bool title_changed = false;
+
+    // clearPixels() only starts a new clear_generation. Tiles are
+    // cleared when first written after that, or in render(); tile t
+    // was last cleared in clear_tags[t].
+    Uint32 *clear_tags = NULL;
+    Uint32 clear_generation = 0;
+    int clear_tiles_x = 0;
+    int clear_tiles_y = 0;
+
+    SDL2AuxFrameSink sink = NULL;
+    void *sink_data = NULL;
+
+    // With SDL2AUX_UPLOAD_CHANGED, uploaded mirrors the texture, so
+    // changed tiles are found by comparing frames with it. Both are
+    // used by the thread that uploads; upload is guarded by
+    // present_mutex when there is a present thread.
+    SDL2AuxUpload upload = SDL2AUX_UPLOAD_FRAME;
+    Uint32 *uploaded = NULL;
+    bool uploaded_valid = false;
+
+    // With HDR, pixels are written as linear floats, three per pixel
+    // with rows packed, and resolved into frame by render(). Helper
+    // threads each resolve a band of rows, started by a new
+    // resolve_generation and counted back in by resolve_pending.
+    struct ResolveHelper {
+      SDL2Aux *aux;
+      int band;
+      SDL_Thread *thread;
+    };
+    float *hdr_buffer = NULL;
+    bool hdr = false;
+    SDL2AuxToneMap tone_map = SDL2AUX_CLAMP;
+    float exposure = 1;
+    ResolveHelper resolve_helpers[7];
+    int resolve_helper_count = 0;
+    int resolve_generation = 0;
+    int resolve_pending = 0;
+    bool resolve_quit = false;
+    SDL_mutex *resolve_mutex = NULL;
+    SDL_cond *resolve_cond = NULL;
 
   public:
     ~SDL2Aux();
-    SDL2Aux(int width, int height, bool fullscreen = false);
+    SDL2Aux(int width, int height, bool fullscreen = false,
+      SDL2AuxFramebuffer framebuffer = SDL2AUX_COPY,
+      SDL2AuxPresent present = SDL2AUX_VSYNC, int buffering = 1);
+    Uint32 *pixels();
+    int pitch();
     void clearPixels();
     void putPixel(int x, int y, glm::vec3 color);
+    void putSpan(int x, int y, int count, const glm::vec3 *colors);
+    void putSpan(int x, int y, int count,
+      const float *red, const float *green, const float *blue);
+    void putTile(int x, int y, int tile_width, int tile_height,
+      const glm::vec3 *colors, int stride);
+    void putFrame(const glm::vec3 *colors);
     void render();
     bool saveBMP(const char *filename);
     bool quitEvent();
     void setWindowTitle(const char *title);
+    void setFrameSink(SDL2AuxFrameSink sink, void *user_data = NULL);
+    void setUpload(SDL2AuxUpload upload);
+    void enableHDR(SDL2AuxToneMap tone_map, float exposure = 1);
+    void disableHDR();
+    static void setThreadHook(SDL2AuxThreadHook hook);
+    static void threadStarted(const char *name);
 
   private:
     bool initializeSDL();
+    bool createClearTags();
     bool createPixelBuffer();
     bool createRenderer();
     bool createTexture();
     bool createWindow();
+    void lockFrame();
+    void clearTile(int tile);
+    void touchSpan(int x, int y, int count);
+    void touchBlock(int x, int y, int block_width, int block_height);
+    void clearUntouched();
+    void writeSpan(int x, int y, int count, const glm::vec3 *colors);
+    bool startPresenting();
+    void queueFrame();
+    static int presentThread(void *data);
+    int presentFrames();
+    void uploadFrame(const Uint32 *pixels, SDL2AuxUpload upload);
+    void uploadChanged(const Uint32 *pixels);
+    void startResolving();
+    void resolveHDR();
+    void resolveBand(int band);
+    static int resolveThread(void *data);
+    int resolveFrames(int band);
 };
 #endif
@@ -0,0 +1,310 @@
+#include <SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "SDL2Auxiliary.h"
+#include "SDL2ImageWriter.h"
+
+using namespace std;
+
+
+/*
+* Starts the writer thread, with room for queue_length frames
+* waiting to be written.
+*/
+SDL2ImageWriter::SDL2ImageWriter(int queue_length) {
+	images.resize(queue_length < 1 ? 1 : queue_length);
+
+	mutex = SDL_CreateMutex();
+	cond = SDL_CreateCond();
+	if (mutex != NULL && cond != NULL) {
+		thread = SDL_CreateThread(writerThread, "SDL2ImageWriter", this);
+	}
+	if (thread == NULL) {
+		cout << "Could not create image writer thread: " << SDL_GetError() << endl;
+	}
+}
+
+
+/*
+* Writes the frames still queued, then stops the writer thread.
+*/
+SDL2ImageWriter::~SDL2ImageWriter() {
+	if (thread != NULL) {
+		finish();
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+		SDL_WaitThread(thread, NULL);
+	}
+	if (cond != NULL) {
+		SDL_DestroyCond(cond);
+	}
+	if (mutex != NULL) {
+		SDL_DestroyMutex(mutex);
+	}
+}
+
+
+/*
+* Queues a frame of 0xAARRGGBB pixels, with rows pitch bytes
+* apart, to be written to filename. The pixels are copied, so
+* they can change as soon as this returns.
+*
+* Returns false if the frame was dropped because the queue is
+* full (or there is no writer thread).
+*/
+bool SDL2ImageWriter::write(const char *filename, SDL2ImageFormat format,
+	const Uint32 *pixels, int width, int height, int pitch) {
+	if (thread == NULL) {
+		return false;
+	}
+
+	SDL_LockMutex(mutex);
+	if (queued == int(images.size())) {
+		++dropped_count;
+		SDL_UnlockMutex(mutex);
+		return false;
+	}
+	Image &image = images[(first + queued) % images.size()];
+	SDL_UnlockMutex(mutex);
+
+	// The slot is ours until it is queued below.
+	snprintf(image.filename, sizeof(image.filename), "%s", filename);
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	image.pixels.resize(width * height);
+	for (int y = 0; y < height; ++y) {
+		const Uint32 *row = (const Uint32 *)((const Uint8 *)pixels + y * pitch);
+		copy(row, row + width, &image.pixels[y * width]);
+	}
+
+	SDL_LockMutex(mutex);
+	++queued;
+	SDL_CondBroadcast(cond);
+	SDL_UnlockMutex(mutex);
+	return true;
+}
+
+
+/*
+* Records every nth frame aux renders, as an image sequence
+* named by pattern, a printf format for the frame number (e.g.
+* "frame%05d.qoi"). Uses the frame sink of aux; pattern has to
+* outlive the capture.
+*/
+void SDL2ImageWriter::capture(SDL2Aux *aux, const char *pattern,
+	SDL2ImageFormat format, int every) {
+	capture_pattern = pattern;
+	capture_format = format;
+	capture_every = every < 1 ? 1 : every;
+	capture_frame = 0;
+	aux->setFrameSink(captureFrame, this);
+}
+
+
+void SDL2ImageWriter::captureFrame(const Uint32 *pixels, int width, int height,
+	int pitch, void *user_data) {
+	SDL2ImageWriter *writer = (SDL2ImageWriter *)user_data;
+	if (writer->capture_frame % writer->capture_every == 0) {
+		char filename[256];
+		snprintf(filename, sizeof(filename), writer->capture_pattern, writer->capture_frame);
+		writer->write(filename, writer->capture_format, pixels, width, height, pitch);
+	}
+	++writer->capture_frame;
+}
+
+
+/*
+* Waits until every queued frame is written.
+*/
+void SDL2ImageWriter::finish() {
+	if (thread == NULL) {
+		return;
+	}
+
+	SDL_LockMutex(mutex);
+	while (queued > 0) {
+		SDL_CondWait(cond, mutex);
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+
+/*
+* Returns the number of images written so far.
+*/
+int SDL2ImageWriter::written() {
+	SDL_LockMutex(mutex);
+	int count = written_count;
+	SDL_UnlockMutex(mutex);
+	return count;
+}
+
+
+/*
+* Returns the number of frames dropped because the queue was
+* full.
+*/
+int SDL2ImageWriter::dropped() {
+	SDL_LockMutex(mutex);
+	int count = dropped_count;
+	SDL_UnlockMutex(mutex);
+	return count;
+}
+
+
+int SDL2ImageWriter::writerThread(void *data) {
+	SDL2Aux::threadStarted("SDL2ImageWriter");
+	return ((SDL2ImageWriter *)data)->writeImages();
+}
+
+
+/*
+* Body of the writer thread: encodes and writes queued images
+* until the destructor stops it.
+*/
+int SDL2ImageWriter::writeImages() {
+	for (;;) {
+		SDL_LockMutex(mutex);
+		while (queued == 0 && !quit) {
+			SDL_CondWait(cond, mutex);
+		}
+		if (queued == 0) {
+			SDL_UnlockMutex(mutex);
+			break;
+		}
+		const Image &image = images[first];
+		SDL_UnlockMutex(mutex);
+
+		if (image.format == SDL2IMAGE_PPM) {
+			encodePPM(image);
+		} else {
+			encodeQOI(image);
+		}
+
+		bool saved = false;
+		FILE *file = fopen(image.filename, "wb");
+		if (file != NULL) {
+			saved = fwrite(&encoded[0], 1, encoded.size(), file) == encoded.size();
+			saved = fclose(file) == 0 && saved;
+		}
+		if (!saved) {
+			cout << "Could not write image " << image.filename << endl;
+		}
+
+		SDL_LockMutex(mutex);
+		first = (first + 1) % images.size();
+		--queued;
+		written_count += saved ? 1 : 0;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+	}
+
+	return 0;
+}
+
+
+/*
+* Encodes a binary PPM (P6) into encoded.
+*/
+void SDL2ImageWriter::encodePPM(const Image &image) {
+	char header[64];
+	int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+		image.width, image.height);
+	int count = image.width * image.height;
+
+	encoded.resize(header_size + 3 * count);
+	copy(header, header + header_size, encoded.begin());
+	Uint8 *out = &encoded[header_size];
+	for (int i = 0; i < count; ++i, out += 3) {
+		Uint32 pixel = image.pixels[i];
+		out[0] = Uint8(pixel >> 16);
+		out[1] = Uint8(pixel >> 8);
+		out[2] = Uint8(pixel);
+	}
+}
+
+
+/*
+* Encodes a QOI image (https://qoiformat.org) with three channels
+* into encoded. Each pixel becomes a run of the previous pixel, an
+* index into the 64 most recently seen colors, a small difference
+* to the previous pixel, or failing all those, the color itself.
+*/
+void SDL2ImageWriter::encodeQOI(const Image &image) {
+	const Uint8 QOI_OP_INDEX = 0x00;
+	const Uint8 QOI_OP_DIFF = 0x40;
+	const Uint8 QOI_OP_LUMA = 0x80;
+	const Uint8 QOI_OP_RUN = 0xc0;
+	const Uint8 QOI_OP_RGB = 0xfe;
+
+	int count = image.width * image.height;
+	// Worst case: every pixel as QOI_OP_RGB, plus header and end marker.
+	encoded.resize(14 + 4 * count + 8);
+	Uint8 *out = &encoded[0];
+
+	Uint8 header[14] = { 'q', 'o', 'i', 'f',
+		Uint8(image.width >> 24), Uint8(image.width >> 16), Uint8(image.width >> 8), Uint8(image.width),
+		Uint8(image.height >> 24), Uint8(image.height >> 16), Uint8(image.height >> 8), Uint8(image.height),
+		3, 0 };
+	out = copy(header, header + 14, out);
+
+	// The alpha channel is opaque throughout, so colors compare as
+	// whole pixels.
+	Uint32 seen[64] = { 0 };
+	Uint32 previous = 0xff000000;
+	int run = 0;
+	for (int i = 0; i < count; ++i) {
+		Uint32 pixel = image.pixels[i] | 0xff000000;
+		if (pixel == previous) {
+			if (++run == 62 || i == count - 1) {
+				*out++ = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+
+		if (run > 0) {
+			*out++ = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		Uint8 r = Uint8(pixel >> 16);
+		Uint8 g = Uint8(pixel >> 8);
+		Uint8 b = Uint8(pixel);
+		int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+		if (seen[hash] == pixel) {
+			*out++ = QOI_OP_INDEX | hash;
+		} else {
+			seen[hash] = pixel;
+
+			// Differences wrap around, as in the format.
+			int dr = Sint8(Uint8(r - Uint8(previous >> 16)));
+			int dg = Sint8(Uint8(g - Uint8(previous >> 8)));
+			int db = Sint8(Uint8(b - Uint8(previous)));
+			int dr_dg = dr - dg;
+			int db_dg = db - dg;
+			if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+				*out++ = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+			} else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+				db_dg >= -8 && db_dg <= 7) {
+				*out++ = QOI_OP_LUMA | (dg + 32);
+				*out++ = Uint8(((dr_dg + 8) << 4) | (db_dg + 8));
+			} else {
+				*out++ = QOI_OP_RGB;
+				*out++ = r;
+				*out++ = g;
+				*out++ = b;
+			}
+		}
+		previous = pixel;
+	}
+
+	const Uint8 end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	out = copy(end, end + 8, out);
+	encoded.resize(out - &encoded[0]);
+}
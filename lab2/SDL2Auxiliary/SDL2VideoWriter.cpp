@@ -0,0 +1,423 @@
+#include <SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "SDL2Auxiliary.h"
+#include "SDL2VideoWriter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SDL2VIDEO_SSE 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+// Frames are written from buffers aligned to this many bytes.
+static const size_t OUTPUT_ALIGNMENT = 64;
+
+
+// BT.601 RGB to limited range YCbCr, for 8-bit components. The
+// offsets include 0.5 so that truncating rounds.
+static inline Uint8 lumaOf(float r, float g, float b) {
+	return Uint8(16.5f + 0.256788f * r + 0.504129f * g + 0.097906f * b);
+}
+
+static inline Uint8 blueDifferenceOf(float r, float g, float b) {
+	return Uint8(128.5f - 0.148223f * r - 0.290993f * g + 0.439216f * b);
+}
+
+static inline Uint8 redDifferenceOf(float r, float g, float b) {
+	return Uint8(128.5f + 0.439216f * r - 0.367788f * g - 0.071427f * b);
+}
+
+
+#ifdef SDL2VIDEO_SSE
+/*
+* Splits four 0xAARRGGBB pixels into their components.
+*/
+static inline void unpackColors(const Uint32 *pixels, __m128 &r, __m128 &g, __m128 &b) {
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i p = _mm_loadu_si128((const __m128i *)pixels);
+	r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+	g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+	b = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+}
+
+
+/*
+* offset + kr * r + kg * g + kb * b for four pixels, truncated to
+* bytes and stored to out.
+*/
+static inline void storeWeighted(Uint8 *out, __m128 r, __m128 g, __m128 b,
+	float offset, float kr, float kg, float kb) {
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(offset),
+		_mm_mul_ps(_mm_set1_ps(kr), r)), _mm_mul_ps(_mm_set1_ps(kg), g)),
+		_mm_mul_ps(_mm_set1_ps(kb), b));
+	__m128i words = _mm_cvttps_epi32(sum);
+	words = _mm_packs_epi32(words, words);
+	int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+	memcpy(out, &bytes, 4);
+}
+
+
+/*
+* Sums of horizontally adjacent pairs in a then b: four 2x2
+* blocks when a and b hold the sums of two rows.
+*/
+static inline __m128 pairSums(__m128 a, __m128 b) {
+	return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+		_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#endif
+
+
+/*
+* Converts two rows of pixels to luma, and to one row of chroma
+* averaged over 2x2 blocks. row1 repeats row0 at the bottom of
+* an image with odd height; luma1 is NULL then.
+*/
+static void convertRows(const Uint32 *row0, const Uint32 *row1, int width,
+	Uint8 *luma0, Uint8 *luma1, Uint8 *cb, Uint8 *cr) {
+	int x = 0;
+
+#ifdef SDL2VIDEO_SSE
+	// Eight pixels of both rows at a time, four chroma samples.
+	for (; x + 8 <= width; x += 8) {
+		__m128 r0a, g0a, b0a, r0b, g0b, b0b, r1a, g1a, b1a, r1b, g1b, b1b;
+		unpackColors(row0 + x, r0a, g0a, b0a);
+		unpackColors(row0 + x + 4, r0b, g0b, b0b);
+		unpackColors(row1 + x, r1a, g1a, b1a);
+		unpackColors(row1 + x + 4, r1b, g1b, b1b);
+
+		storeWeighted(luma0 + x, r0a, g0a, b0a, 16.5f, 0.256788f, 0.504129f, 0.097906f);
+		storeWeighted(luma0 + x + 4, r0b, g0b, b0b, 16.5f, 0.256788f, 0.504129f, 0.097906f);
+		if (luma1 != NULL) {
+			storeWeighted(luma1 + x, r1a, g1a, b1a, 16.5f, 0.256788f, 0.504129f, 0.097906f);
+			storeWeighted(luma1 + x + 4, r1b, g1b, b1b, 16.5f, 0.256788f, 0.504129f, 0.097906f);
+		}
+
+		const __m128 quarter = _mm_set1_ps(0.25f);
+		__m128 r = _mm_mul_ps(pairSums(_mm_add_ps(r0a, r1a), _mm_add_ps(r0b, r1b)), quarter);
+		__m128 g = _mm_mul_ps(pairSums(_mm_add_ps(g0a, g1a), _mm_add_ps(g0b, g1b)), quarter);
+		__m128 b = _mm_mul_ps(pairSums(_mm_add_ps(b0a, b1a), _mm_add_ps(b0b, b1b)), quarter);
+		storeWeighted(cb + x / 2, r, g, b, 128.5f, -0.148223f, -0.290993f, 0.439216f);
+		storeWeighted(cr + x / 2, r, g, b, 128.5f, 0.439216f, -0.367788f, -0.071427f);
+	}
+#endif
+
+	// The rest in 2x2 blocks, repeating the last column of an image
+	// with odd width.
+	for (; x < width; x += 2) {
+		int x1 = min(x + 1, width - 1);
+		Uint32 p[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+		float r[4], g[4], b[4];
+		for (int i = 0; i < 4; ++i) {
+			r[i] = float((p[i] >> 16) & 0xff);
+			g[i] = float((p[i] >> 8) & 0xff);
+			b[i] = float(p[i] & 0xff);
+		}
+
+		luma0[x] = lumaOf(r[0], g[0], b[0]);
+		luma0[x1] = lumaOf(r[1], g[1], b[1]);
+		if (luma1 != NULL) {
+			luma1[x] = lumaOf(r[2], g[2], b[2]);
+			luma1[x1] = lumaOf(r[3], g[3], b[3]);
+		}
+
+		float red = ((r[0] + r[2]) + (r[1] + r[3])) * 0.25f;
+		float green = ((g[0] + g[2]) + (g[1] + g[3])) * 0.25f;
+		float blue = ((b[0] + b[2]) + (b[1] + b[3])) * 0.25f;
+		cb[x / 2] = blueDifferenceOf(red, green, blue);
+		cr[x / 2] = redDifferenceOf(red, green, blue);
+	}
+}
+
+
+/*
+* Opens filename for the stream, or standard output if it is
+* "-", and starts the worker thread with room for queue_length
+* frames. fps only goes into the Y4M header.
+*/
+SDL2VideoWriter::SDL2VideoWriter(const char *filename, SDL2VideoFormat format,
+	int fps, int queue_length) {
+	this->format = format;
+	this->fps = fps;
+	frames.resize(queue_length < 1 ? 1 : queue_length);
+
+	if (strcmp(filename, "-") == 0) {
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		file = stdout;
+	} else {
+		file = fopen(filename, "wb");
+	}
+	if (file == NULL) {
+		cout << "Could not open video file " << filename << endl;
+		return;
+	}
+	// Whole frames are written at once, from aligned buffers.
+	setvbuf(file, NULL, _IONBF, 0);
+
+	mutex = SDL_CreateMutex();
+	cond = SDL_CreateCond();
+	if (mutex != NULL && cond != NULL) {
+		thread = SDL_CreateThread(writerThread, "SDL2VideoWriter", this);
+	}
+	if (thread == NULL) {
+		cout << "Could not create video writer thread: " << SDL_GetError() << endl;
+	}
+}
+
+
+/*
+* Writes the frames still queued, stops the worker thread and
+* closes the file.
+*/
+SDL2VideoWriter::~SDL2VideoWriter() {
+	if (thread != NULL) {
+		finish();
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+		SDL_WaitThread(thread, NULL);
+	}
+	if (cond != NULL) {
+		SDL_DestroyCond(cond);
+	}
+	if (mutex != NULL) {
+		SDL_DestroyMutex(mutex);
+	}
+
+	if (file != NULL && file != stdout) {
+		fclose(file);
+	} else if (file != NULL) {
+		fflush(file);
+	}
+}
+
+
+/*
+* Returns true if frames can be written.
+*/
+bool SDL2VideoWriter::isOpen() {
+	return thread != NULL;
+}
+
+
+/*
+* Queues a frame of 0xAARRGGBB pixels, with rows pitch bytes
+* apart. The pixels are copied, so they can change as soon as
+* this returns. Waits while the queue is full. Frames of a
+* different size than the first are skipped.
+*/
+void SDL2VideoWriter::write(const Uint32 *pixels, int width, int height, int pitch) {
+	if (thread == NULL) {
+		return;
+	}
+	if (this->width == 0) {
+		this->width = width;
+		this->height = height;
+	}
+	if (width != this->width || height != this->height) {
+		return;
+	}
+
+	SDL_LockMutex(mutex);
+	while (queued == int(frames.size())) {
+		SDL_CondWait(cond, mutex);
+	}
+	Frame &frame = frames[(first + queued) % frames.size()];
+	SDL_UnlockMutex(mutex);
+
+	// The slot is ours until it is queued below.
+	frame.pixels.resize(width * height);
+	for (int y = 0; y < height; ++y) {
+		const Uint32 *row = (const Uint32 *)((const Uint8 *)pixels + y * pitch);
+		copy(row, row + width, &frame.pixels[y * width]);
+	}
+
+	SDL_LockMutex(mutex);
+	++queued;
+	SDL_CondBroadcast(cond);
+	SDL_UnlockMutex(mutex);
+}
+
+
+/*
+* Records every frame aux renders, through its frame sink.
+*/
+void SDL2VideoWriter::capture(SDL2Aux *aux) {
+	aux->setFrameSink(captureFrame, this);
+}
+
+
+void SDL2VideoWriter::captureFrame(const Uint32 *pixels, int width, int height,
+	int pitch, void *user_data) {
+	((SDL2VideoWriter *)user_data)->write(pixels, width, height, pitch);
+}
+
+
+/*
+* Waits until every queued frame is written.
+*/
+void SDL2VideoWriter::finish() {
+	if (thread == NULL) {
+		return;
+	}
+
+	SDL_LockMutex(mutex);
+	while (queued > 0) {
+		SDL_CondWait(cond, mutex);
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+
+/*
+* Returns the number of frames written so far.
+*/
+int SDL2VideoWriter::written() {
+	if (thread == NULL) {
+		return 0;
+	}
+
+	SDL_LockMutex(mutex);
+	int count = written_count;
+	SDL_UnlockMutex(mutex);
+	return count;
+}
+
+
+int SDL2VideoWriter::writerThread(void *data) {
+	SDL2Aux::threadStarted("SDL2VideoWriter");
+	return ((SDL2VideoWriter *)data)->writeFrames();
+}
+
+
+/*
+* Body of the worker thread: converts and writes queued frames
+* until the destructor stops it. The stream header goes out with
+* the first frame, once its size is known.
+*/
+int SDL2VideoWriter::writeFrames() {
+	bool failed = false;
+	for (;;) {
+		SDL_LockMutex(mutex);
+		while (queued == 0 && !quit) {
+			SDL_CondWait(cond, mutex);
+		}
+		if (queued == 0) {
+			SDL_UnlockMutex(mutex);
+			break;
+		}
+		const Frame &frame = frames[first];
+		bool header = written_count == 0;
+		SDL_UnlockMutex(mutex);
+
+		if (header && format == SDL2VIDEO_Y4M) {
+			fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		}
+
+		if (format == SDL2VIDEO_Y4M) {
+			convertY4M(&frame.pixels[0]);
+		} else {
+			convertRGBA(&frame.pixels[0]);
+		}
+		if (!failed && fwrite(output, 1, output_size, file) != output_size) {
+			cout << "Could not write video frame" << endl;
+			failed = true;
+		}
+
+		SDL_LockMutex(mutex);
+		first = (first + 1) % frames.size();
+		--queued;
+		++written_count;
+		SDL_CondBroadcast(cond);
+		SDL_UnlockMutex(mutex);
+	}
+
+	return 0;
+}
+
+
+/*
+* Converts a frame to a Y4M frame in output: a "FRAME" line, then
+* the luma plane and the two chroma planes at half resolution.
+*/
+void SDL2VideoWriter::convertY4M(const Uint32 *pixels) {
+	const char marker[] = "FRAME\n";
+	const size_t marker_size = sizeof(marker) - 1;
+	int chroma_width = (width + 1) / 2;
+	int chroma_height = (height + 1) / 2;
+	size_t size = marker_size + width * height + 2 * chroma_width * chroma_height;
+	if (output_size != size) {
+		output_storage.resize(size + OUTPUT_ALIGNMENT);
+		size_t misalignment = size_t(&output_storage[0]) % OUTPUT_ALIGNMENT;
+		output = &output_storage[0] + (misalignment ? OUTPUT_ALIGNMENT - misalignment : 0);
+		output_size = size;
+	}
+
+	memcpy(output, marker, marker_size);
+	Uint8 *luma = output + marker_size;
+	Uint8 *cb = luma + width * height;
+	Uint8 *cr = cb + chroma_width * chroma_height;
+	for (int y = 0; y < height; y += 2) {
+		const Uint32 *row0 = pixels + y * width;
+		bool last = y + 1 == height;
+		convertRows(row0,
+			last ? row0 : row0 + width,
+			width,
+			luma + y * width,
+			last ? NULL : luma + (y + 1) * width,
+			cb + (y / 2) * chroma_width,
+			cr + (y / 2) * chroma_width);
+	}
+}
+
+
+/*
+* Converts a frame to RGBA bytes in output.
+*/
+void SDL2VideoWriter::convertRGBA(const Uint32 *pixels) {
+	int count = width * height;
+	size_t size = count * sizeof(Uint32);
+	if (output_size != size) {
+		output_storage.resize(size + OUTPUT_ALIGNMENT);
+		size_t misalignment = size_t(&output_storage[0]) % OUTPUT_ALIGNMENT;
+		output = &output_storage[0] + (misalignment ? OUTPUT_ALIGNMENT - misalignment : 0);
+		output_size = size;
+	}
+
+	// 0xAARRGGBB to R, G, B, A in memory: 0xAABBGGRR on little endian
+	// machines (all that have SSE2), 0xRRGGBBAA on big endian ones.
+	Uint32 *out = (Uint32 *)output;
+	int i = 0;
+#ifdef SDL2VIDEO_SSE
+	const __m128i keep = _mm_set1_epi32(int(0xff00ff00));
+	const __m128i low = _mm_set1_epi32(0xff);
+	for (; i + 4 <= count; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(pixels + i));
+		__m128i swapped = _mm_or_si128(_mm_and_si128(p, keep),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), low),
+			_mm_slli_epi32(_mm_and_si128(p, low), 16)));
+		_mm_store_si128((__m128i *)(out + i), swapped);
+	}
+#endif
+	for (; i < count; ++i) {
+		Uint32 p = pixels[i];
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+		out[i] = (p << 8) | (p >> 24);
+#else
+		out[i] = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+#endif
+	}
+}
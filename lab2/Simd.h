@@ -0,0 +1,271 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Minimal 4-wide float vector used for rasterization and texture
+// sampling. Maps onto SSE when the compiler targets it and falls back to
+// plain arrays otherwise (e.g. the arm64 macOS build), so callers never
+// touch intrinsics.
+//
+// Comparisons return lane masks (all bits set where true) that combine with
+// & and |, feed Select() and collapse to one bit per lane with MoveMask().
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#else
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#endif
+
+// Rounds n up to a whole number of lanes, for arrays processed 4 at a time.
+inline int SimdPadded( int n )
+{
+	return (n + 3) & ~3;
+}
+
+struct Float4
+{
+#ifdef SIMD_SSE
+	__m128 v;
+
+	Float4() {}
+	Float4( __m128 v ) : v(v) {}
+
+	static Float4 Set1( float a ) { return _mm_set1_ps(a); }
+	static Float4 Set( float a, float b, float c, float d ) { return _mm_setr_ps(a, b, c, d); }
+	static Float4 Load( const float* p ) { return _mm_loadu_ps(p); }
+	void Store( float* p ) const { _mm_storeu_ps(p, v); }
+
+	// Lanes (a[0], a[1], b[0], b[1]), e.g. a 2x2 block from two image rows.
+	static Float4 LoadPairs( const float* a, const float* b )
+	{
+		__m128 lo = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(a));
+		return _mm_loadh_pi(lo, reinterpret_cast<const __m64*>(b));
+	}
+	void StorePairs( float* a, float* b ) const
+	{
+		_mm_storel_pi(reinterpret_cast<__m64*>(a), v);
+		_mm_storeh_pi(reinterpret_cast<__m64*>(b), v);
+	}
+
+	friend Float4 operator+( Float4 a, Float4 b ) { return _mm_add_ps(a.v, b.v); }
+	friend Float4 operator-( Float4 a, Float4 b ) { return _mm_sub_ps(a.v, b.v); }
+	friend Float4 operator*( Float4 a, Float4 b ) { return _mm_mul_ps(a.v, b.v); }
+	friend Float4 operator/( Float4 a, Float4 b ) { return _mm_div_ps(a.v, b.v); }
+	friend Float4 Min( Float4 a, Float4 b ) { return _mm_min_ps(a.v, b.v); }
+	friend Float4 Max( Float4 a, Float4 b ) { return _mm_max_ps(a.v, b.v); }
+	friend Float4 Sqrt( Float4 a ) { return _mm_sqrt_ps(a.v); }
+
+	friend Float4 operator>( Float4 a, Float4 b ) { return _mm_cmpgt_ps(a.v, b.v); }
+	friend Float4 operator>=( Float4 a, Float4 b ) { return _mm_cmpge_ps(a.v, b.v); }
+	friend Float4 operator&( Float4 a, Float4 b ) { return _mm_and_ps(a.v, b.v); }
+	friend Float4 operator|( Float4 a, Float4 b ) { return _mm_or_ps(a.v, b.v); }
+	friend int MoveMask( Float4 mask ) { return _mm_movemask_ps(mask.v); }
+	// Inverse of MoveMask(): lane i is set if bit i is.
+	static Float4 Mask( int bits )
+	{
+		return _mm_castsi128_ps(_mm_setr_epi32(-(bits & 1), -((bits >> 1) & 1),
+			-((bits >> 2) & 1), -((bits >> 3) & 1)));
+	}
+	friend Float4 Select( Float4 mask, Float4 a, Float4 b )
+	{
+		return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+	}
+
+	float operator[]( int i ) const
+	{
+		float lanes[4];
+		_mm_storeu_ps(lanes, v);
+		return lanes[i];
+	}
+#else
+	float v[4];
+
+	Float4() {}
+
+	static Float4 Set1( float a ) { return Set(a, a, a, a); }
+	static Float4 Set( float a, float b, float c, float d )
+	{
+		Float4 r;
+		r.v[0] = a; r.v[1] = b; r.v[2] = c; r.v[3] = d;
+		return r;
+	}
+	static Float4 Load( const float* p ) { return Set(p[0], p[1], p[2], p[3]); }
+	void Store( float* p ) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+
+	static Float4 LoadPairs( const float* a, const float* b ) { return Set(a[0], a[1], b[0], b[1]); }
+	void StorePairs( float* a, float* b ) const { a[0] = v[0]; a[1] = v[1]; b[0] = v[2]; b[1] = v[3]; }
+
+#define SIMD_SCALAR_OP(name, expr) \
+	friend Float4 name( Float4 a, Float4 b ) \
+	{ \
+		Float4 r; \
+		for (int i = 0; i < 4; ++i) r.v[i] = (expr); \
+		return r; \
+	}
+	SIMD_SCALAR_OP(operator+, a.v[i] + b.v[i])
+	SIMD_SCALAR_OP(operator-, a.v[i] - b.v[i])
+	SIMD_SCALAR_OP(operator*, a.v[i] * b.v[i])
+	SIMD_SCALAR_OP(operator/, a.v[i] / b.v[i])
+	SIMD_SCALAR_OP(Min, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+	SIMD_SCALAR_OP(Max, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef SIMD_SCALAR_OP
+
+	friend Float4 Sqrt( Float4 a )
+	{
+		Float4 r;
+		for (int i = 0; i < 4; ++i) r.v[i] = std::sqrt(a.v[i]);
+		return r;
+	}
+
+	// Masks keep their lanes as bit patterns in the float array.
+	static uint32_t Bits( float f ) { uint32_t u; std::memcpy(&u, &f, 4); return u; }
+	static float FromBits( uint32_t u ) { float f; std::memcpy(&f, &u, 4); return f; }
+
+#define SIMD_SCALAR_MASK_OP(name, expr) \
+	friend Float4 name( Float4 a, Float4 b ) \
+	{ \
+		Float4 r; \
+		for (int i = 0; i < 4; ++i) r.v[i] = FromBits(expr); \
+		return r; \
+	}
+	SIMD_SCALAR_MASK_OP(operator>, a.v[i] > b.v[i] ? 0xffffffffu : 0u)
+	SIMD_SCALAR_MASK_OP(operator>=, a.v[i] >= b.v[i] ? 0xffffffffu : 0u)
+	SIMD_SCALAR_MASK_OP(operator&, Bits(a.v[i]) & Bits(b.v[i]))
+	SIMD_SCALAR_MASK_OP(operator|, Bits(a.v[i]) | Bits(b.v[i]))
+#undef SIMD_SCALAR_MASK_OP
+
+	friend int MoveMask( Float4 mask )
+	{
+		int r = 0;
+		for (int i = 0; i < 4; ++i) r |= int(Bits(mask.v[i]) >> 31) << i;
+		return r;
+	}
+
+	static Float4 Mask( int bits )
+	{
+		Float4 r;
+		for (int i = 0; i < 4; ++i) r.v[i] = FromBits((bits >> i) & 1 ? 0xffffffffu : 0u);
+		return r;
+	}
+
+	friend Float4 Select( Float4 mask, Float4 a, Float4 b )
+	{
+		Float4 r;
+		for (int i = 0; i < 4; ++i) r.v[i] = Bits(mask.v[i]) ? a.v[i] : b.v[i];
+		return r;
+	}
+
+	float operator[]( int i ) const { return v[i]; }
+#endif
+};
+
+// 4-wide 32-bit integer vector for exact edge function tests and texel
+// addressing. Shifts are logical.
+struct Int4
+{
+#ifdef SIMD_SSE
+	__m128i v;
+
+	Int4() {}
+	Int4( __m128i v ) : v(v) {}
+
+	static Int4 Set1( int a ) { return _mm_set1_epi32(a); }
+	static Int4 Set( int a, int b, int c, int d ) { return _mm_setr_epi32(a, b, c, d); }
+	static Int4 Load( const int* p ) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+	void Store( int* p ) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+	friend Int4 operator+( Int4 a, Int4 b ) { return _mm_add_epi32(a.v, b.v); }
+	friend Int4 operator-( Int4 a, Int4 b ) { return _mm_sub_epi32(a.v, b.v); }
+	friend Int4 operator&( Int4 a, Int4 b ) { return _mm_and_si128(a.v, b.v); }
+	friend Int4 operator|( Int4 a, Int4 b ) { return _mm_or_si128(a.v, b.v); }
+	friend Int4 operator<<( Int4 a, int n ) { return _mm_slli_epi32(a.v, n); }
+	friend Int4 operator>>( Int4 a, int n ) { return _mm_srli_epi32(a.v, n); }
+	friend Float4 operator>( Int4 a, Int4 b ) { return _mm_castsi128_ps(_mm_cmpgt_epi32(a.v, b.v)); }
+
+	friend Float4 ToFloat( Int4 a ) { return _mm_cvtepi32_ps(a.v); }
+#else
+	int v[4];
+
+	Int4() {}
+
+	static Int4 Set1( int a ) { return Set(a, a, a, a); }
+	static Int4 Set( int a, int b, int c, int d )
+	{
+		Int4 r;
+		r.v[0] = a; r.v[1] = b; r.v[2] = c; r.v[3] = d;
+		return r;
+	}
+
+	static Int4 Load( const int* p ) { return Set(p[0], p[1], p[2], p[3]); }
+	void Store( int* p ) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+
+#define SIMD_SCALAR_INT_OP(name, type, expr) \
+	friend Int4 name( Int4 a, type b ) \
+	{ \
+		Int4 r; \
+		for (int i = 0; i < 4; ++i) r.v[i] = (expr); \
+		return r; \
+	}
+	SIMD_SCALAR_INT_OP(operator+, Int4, a.v[i] + b.v[i])
+	SIMD_SCALAR_INT_OP(operator-, Int4, a.v[i] - b.v[i])
+	SIMD_SCALAR_INT_OP(operator&, Int4, a.v[i] & b.v[i])
+	SIMD_SCALAR_INT_OP(operator|, Int4, a.v[i] | b.v[i])
+	SIMD_SCALAR_INT_OP(operator<<, int, int(uint32_t(a.v[i]) << b))
+	SIMD_SCALAR_INT_OP(operator>>, int, int(uint32_t(a.v[i]) >> b))
+#undef SIMD_SCALAR_INT_OP
+
+	friend Float4 operator>( Int4 a, Int4 b )
+	{
+		return Float4::Mask((a.v[0] > b.v[0]) | (a.v[1] > b.v[1]) << 1 |
+			(a.v[2] > b.v[2]) << 2 | (a.v[3] > b.v[3]) << 3);
+	}
+
+	friend Float4 ToFloat( Int4 a ) { return Float4::Set(float(a.v[0]), float(a.v[1]), float(a.v[2]), float(a.v[3])); }
+#endif
+};
+
+// Rounds towards minus infinity.
+inline Int4 FloorToInt( Float4 a )
+{
+#ifdef SIMD_SSE
+	// cvttps truncates; step down where that rounded up
+	__m128i i = _mm_cvttps_epi32(a.v);
+	__m128 above = _mm_cmpgt_ps(_mm_cvtepi32_ps(i), a.v);
+	return _mm_add_epi32(i, _mm_castps_si128(above));
+#else
+	return Int4::Set(int(std::floor(a[0])), int(std::floor(a[1])), int(std::floor(a[2])), int(std::floor(a[3])));
+#endif
+}
+
+// Four 3D vectors in structure-of-arrays form, one per lane.
+struct Vec3x4
+{
+	Float4 x, y, z;
+
+	Vec3x4() {}
+	Vec3x4( Float4 x, Float4 y, Float4 z ) : x(x), y(y), z(z) {}
+
+	static Vec3x4 Set1( const glm::vec3& a )
+	{
+		return Vec3x4(Float4::Set1(a.x), Float4::Set1(a.y), Float4::Set1(a.z));
+	}
+
+	glm::vec3 Lane( int i ) const { return glm::vec3(x[i], y[i], z[i]); }
+
+	friend Vec3x4 operator+( const Vec3x4& a, const Vec3x4& b ) { return Vec3x4(a.x + b.x, a.y + b.y, a.z + b.z); }
+	friend Vec3x4 operator-( const Vec3x4& a, const Vec3x4& b ) { return Vec3x4(a.x - b.x, a.y - b.y, a.z - b.z); }
+	friend Vec3x4 operator*( const Vec3x4& a, const Vec3x4& b ) { return Vec3x4(a.x * b.x, a.y * b.y, a.z * b.z); }
+	friend Vec3x4 operator*( const Vec3x4& a, Float4 s ) { return Vec3x4(a.x * s, a.y * s, a.z * s); }
+	friend Float4 Dot( const Vec3x4& a, const Vec3x4& b ) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	friend Vec3x4 Cross( const Vec3x4& a, const Vec3x4& b )
+	{
+		return Vec3x4(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+	friend Vec3x4 Normalize( const Vec3x4& a ) { return a * (Float4::Set1(1.0f) / Sqrt(Dot(a, a))); }
+};
+
+#endif
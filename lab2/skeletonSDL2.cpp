@@ -2,9 +2,12 @@
 #include <iostream>
 #include <glm/glm.hpp>
 #include "SDL2auxiliary.h"
+#include "SDL2ImageWriter.h"
+#include "SDL2VideoWriter.h"
 #include "TestModel.h"
 
 using namespace std;
+using glm::vec2;
 using glm::vec3;
 using glm::mat3;
 
@@ -16,6 +19,7 @@ const int SCREEN_HEIGHT = 100;
 SDL2Aux* sdlAux;
 int t;
 vector<Triangle> triangles;
+vector<Texture> textures;
 float focalLength = SCREEN_HEIGHT;
 vec3 cameraPos(0, 0, -3);
 mat3 R = mat3(vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1));
@@ -33,6 +37,7 @@ struct Intersection
 	vec3 position;
 	float distance;
 	int triangleIndex;
+	float u, v;		// Barycentric coordinates along e1 and e2
 };
 
 // ----------------------------------------------------------------------------
@@ -40,21 +45,85 @@ struct Intersection
 
 void Update(void);
 void Draw(void);
+vec3 SolveIntersection(const Triangle& triangle, vec3 start, vec3 dir);
 bool ClosestIntersection(vec3 start, vec3 dir, const vector <Triangle >& triangles, Intersection& closeIntersection);
 vec3 DirectLight(const Intersection& i);
+vec3 SurfaceColor(const Intersection& i, vec3 dirX, vec3 dirY);
 
 int main(int argc, char* argv[])
 {
-	sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT);
+	// "--headless N" renders N frames without a window, e.g. for benchmark
+	// runs on a machine without a display. "--capture N" saves every Nth
+	// frame as an image, "--record FILE" streams every frame to FILE: Y4M
+	// video if it ends in .y4m, raw RGBA otherwise. Only one of the two
+	// can be used at a time.
+	int headlessFrames = 0;
+	int captureEvery = 0;
+	const char* recordFile = NULL;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (string(argv[i]) == "--headless")
+			headlessFrames = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "--capture")
+			captureEvery = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "--record")
+			recordFile = argv[i + 1];
+	}
+	if (captureEvery > 0 && recordFile != NULL)
+	{
+		cerr << "--capture and --record cannot be used together." << endl;
+		return 1;
+	}
+	// Recording to standard output ("-") takes it over for the video.
+	if (recordFile != NULL && string(recordFile) == "-")
+		cout.rdbuf(cerr.rdbuf());
+
+	if (headlessFrames > 0)
+		sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT, false, SDL2AUX_COPY, SDL2AUX_HEADLESS);
+	else
+	{
+		// Frames take far longer than a vertical blank, so a single
+		// buffer presented by render() loses nothing. It is copied
+		// rather than locked, so the screenshot at exit has a frame.
+		sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT, false, SDL2AUX_COPY, SDL2AUX_VSYNC, 1);
+	}
+	SDL2ImageWriter* imageWriter = NULL;
+	if (captureEvery > 0)
+	{
+		imageWriter = new SDL2ImageWriter();
+		imageWriter->capture(sdlAux, "frame%05d.qoi", SDL2IMAGE_QOI, captureEvery);
+	}
+	SDL2VideoWriter* videoWriter = NULL;
+	if (recordFile != NULL)
+	{
+		string name(recordFile);
+		bool y4m = name.size() > 4 && name.compare(name.size() - 4, 4, ".y4m") == 0;
+		videoWriter = new SDL2VideoWriter(recordFile, y4m ? SDL2VIDEO_Y4M : SDL2VIDEO_RGBA);
+		videoWriter->capture(sdlAux);
+	}
 	t = SDL_GetTicks();	// Set start value for timer.
 	LoadTestModel(triangles);
+	LoadTestTextures(textures);
 
-	while (!sdlAux->quitEvent())
+	for (int frame = 0; !sdlAux->quitEvent() && (headlessFrames == 0 || frame < headlessFrames); ++frame)
 	{
 		Update();
 		Draw();
 	}
 	sdlAux->saveBMP("screenshot.bmp");
+	delete sdlAux;	// Stops the present thread
+	if (imageWriter != NULL)
+	{
+		imageWriter->finish();
+		cout << "Captured " << imageWriter->written() << " frames, dropped " << imageWriter->dropped() << endl;
+		delete imageWriter;
+	}
+	if (videoWriter != NULL)
+	{
+		videoWriter->finish();
+		cout << "Recorded " << videoWriter->written() << " frames" << endl;
+		delete videoWriter;
+	}
 	return 0;
 }
 
@@ -119,17 +188,30 @@ void Update(void)
 	{
 		lightPos += movement * vec3(R[2][0], R[2][1], R[2][2]);
 	}
+
+	// Tone map (ACES) instead of clipping the bright light with H, back with B
+	if (keystate[SDL_SCANCODE_H])
+	{
+		sdlAux->enableHDR(SDL2AUX_ACES);
+	}
+
+	if (keystate[SDL_SCANCODE_B])
+	{
+		sdlAux->disableHDR();
+	}
 }
 
 void Draw()
 {
-	sdlAux->clearPixels();
+	vec3 row[SCREEN_WIDTH];		// Every pixel is written, a row at a time
 
 	for (int y = 0; y < SCREEN_HEIGHT; ++y)
 	{
 		for (int x = 0; x < SCREEN_WIDTH; ++x)
 		{
 			vec3 dir(x - SCREEN_WIDTH / 2, y - SCREEN_HEIGHT / 2, focalLength);
+			vec3 dirX = dir + vec3(1, 0, 0);	// Rays through the neighbouring pixels
+			vec3 dirY = dir + vec3(0, 1, 0);
 			dir = glm::normalize(dir);
 
 			Intersection closeIntersection;
@@ -137,7 +219,7 @@ void Draw()
 
 			if (ClosestIntersection(cameraPos, dir, triangles, closeIntersection))
 			{
-				color = triangles[closeIntersection.triangleIndex].color;
+				color = SurfaceColor(closeIntersection, dirX, dirY);
 
 				// Direct Lighting (Task 6.3)
 				//color *= DirectLight(closeIntersection);
@@ -146,12 +228,27 @@ void Draw()
 				color *= (DirectLight(closeIntersection) + indirectLight);
 			}
 
-			sdlAux->putPixel(x, y, color);
+			row[x] = color;
 		}
+		sdlAux->putSpan(0, y, SCREEN_WIDTH, row);
 	}
 	sdlAux->render();
 }
 
+// Solves start + t * dir = v0 + u * e1 + v * e2 for (t, u, v), i.e. where
+// the ray meets the plane of the triangle.
+vec3 SolveIntersection(const Triangle& triangle, vec3 start, vec3 dir)
+{
+	vec3 v0 = triangle.v0 * R;
+	vec3 v1 = triangle.v1 * R;
+	vec3 v2 = triangle.v2 * R;
+	vec3 e1 = v1 - v0;
+	vec3 e2 = v2 - v0;
+	vec3 b = start - v0;
+	mat3 A(-dir, e1, e2);
+	return glm::inverse(A) * b;
+}
+
 bool ClosestIntersection(vec3 start, vec3 dir, const vector <Triangle >& triangles, Intersection& closeIntersection)
 {
 	float m = std::numeric_limits<float>::max();
@@ -159,15 +256,7 @@ bool ClosestIntersection(vec3 start, vec3 dir, const vector <Triangle >& triangl
 
 	for (size_t i = 0; i < triangles.size(); i++)
 	{
-		const Triangle triangle = triangles[i];
-		vec3 v0 = triangle.v0 * R;
-		vec3 v1 = triangle.v1 * R;
-		vec3 v2 = triangle.v2 * R;
-		vec3 e1 = v1 - v0;
-		vec3 e2 = v2 - v0;
-		vec3 b = start - v0;
-		mat3 A(-dir, e1, e2);
-		vec3 x = glm::inverse(A) * b;
+		vec3 x = SolveIntersection(triangles[i], start, dir);
 
 		float t = x.x, u = x.y, v = x.z;
 
@@ -178,6 +267,8 @@ bool ClosestIntersection(vec3 start, vec3 dir, const vector <Triangle >& triangl
 			closeIntersection.position = start + t * dir;
 			closeIntersection.distance = t;
 			closeIntersection.triangleIndex = i;
+			closeIntersection.u = u;
+			closeIntersection.v = v;
 		}
 
 	}
@@ -201,3 +292,23 @@ vec3 DirectLight(const Intersection& i)
 
 	return D * max;
 }
+
+// Reflectance at an intersection, modulated by the triangle's texture if it
+// has one. The mip level comes from ray differentials: the texture
+// coordinates where the rays through the neighbouring pixels (dirX, dirY)
+// meet the triangle's plane.
+vec3 SurfaceColor(const Intersection& i, vec3 dirX, vec3 dirY)
+{
+	const Triangle& triangle = triangles[i.triangleIndex];
+	if (triangle.texture < 0)
+		return triangle.color;
+
+	vec2 uv = triangle.TexCoord(i.u, i.v);
+	vec3 x = SolveIntersection(triangle, cameraPos, dirX);
+	vec3 y = SolveIntersection(triangle, cameraPos, dirY);
+	vec2 dx = triangle.TexCoord(x.y, x.z) - uv;
+	vec2 dy = triangle.TexCoord(y.y, y.z) - uv;
+
+	const Texture& texture = textures[triangle.texture];
+	return triangle.color * texture.Sample(uv, texture.Lod(dx, dy));
+}
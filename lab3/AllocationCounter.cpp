@@ -0,0 +1,32 @@
+// Debug allocation counter: every global operator new bumps heapAllocations
+// so the renderer can assert that a steady-state frame did not touch the
+// heap. The count is shared by all threads, so the thread pool's workers
+// are counted along with the render thread; threads that run beside the
+// frame without being part of it (SDL2Aux's present and HDR resolve
+// threads, the image and video writers) set heapAllocationsIgnored. Kept in
+// its own translation unit so the replacement operators are not inlined
+// into (and mismatched against) callers.
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "FrameArena.h"
+
+#ifndef NDEBUG
+std::atomic<size_t> heapAllocations(0);
+thread_local bool heapAllocationsIgnored = false;
+
+void* operator new(size_t size)
+{
+	if (!heapAllocationsIgnored)
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+#endif
@@ -0,0 +1,168 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+// Draw submission through a command buffer. Instead of drawing straight
+// away, callers record draws of mesh objects; the buffer is sorted by
+// material and, within a material, front to back, and then executed with
+// the shaders of the current mode. Front-to-back order lets the depth test
+// reject hidden fragments before their pixel shader runs, and consecutive
+// draws of one material keep the shader's texture branch and texels hot.
+//
+// A command draws one meshlet, culled against the view and its normal cone
+// when it is recorded, or a whole level of detail of a mesh without
+// meshlets. The material is the meshlet's texture, the only state that
+// changes the shader work here. The test model is stored in world space,
+// so commands carry no transform.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+
+struct DrawCommand
+{
+	uint64_t key;				// Material above, view depth of the nearest point below
+	const IndexedMesh* mesh;
+	int meshlet;				// Index in mesh->meshlets, -1 for the whole level
+	int lod;					// Index in mesh->lods
+};
+
+// Sort key: the material in the upper 32 bits (untextured first), then the
+// depth's float bits, which order like the depth for non-negative values.
+inline uint64_t DrawCommandKey( int texture, float depth )
+{
+	float clamped = std::max(depth, 0.0f);
+	uint32_t bits;
+	std::memcpy(&bits, &clamped, sizeof(bits));
+	return (uint64_t(uint32_t(texture + 1)) << 32) | bits;
+}
+
+class CommandBuffer
+{
+public:
+	// Makes room for every meshlet and level of the mesh, so recording it
+	// never allocates.
+	void Reserve( const IndexedMesh& mesh )
+	{
+		commands.reserve(commands.capacity() + mesh.meshlets.size() + mesh.lods.size());
+	}
+
+	void Reset()
+	{
+		commands.clear();
+	}
+
+	// Records the objects of a mesh picked by selection, as seen from
+	// camera. Culling counts go to selection.stats.
+	void Record( const IndexedMesh& mesh, const Camera& camera, const DrawSelection& selection )
+	{
+		DrawStats* stats = selection.stats;
+		for (size_t o = 0; o < mesh.objects.size(); ++o)
+		{
+			if (selection.visible != NULL && !selection.visible[o])
+				continue;
+
+			int level = selection.lodLevels != NULL ? selection.lodLevels[o] : 0;
+			int lodIndex = mesh.objects[o].firstLod + level;
+			const MeshLod& lod = mesh.lods[lodIndex];
+			if (stats != NULL)
+				++stats->objects;
+			if (lod.meshletCount == 0)
+			{
+				const MeshObject& object = mesh.objects[o];
+				glm::vec3 center = 0.5f * (object.boundsMin + object.boundsMax);
+				float radius = 0.5f * glm::length(object.boundsMax - object.boundsMin);
+				DrawCommand command = { DrawCommandKey(mesh.textures[lod.firstTriangle],
+					camera.ToView(center).z - radius), &mesh, -1, lodIndex };
+				commands.push_back(command);
+				continue;
+			}
+
+			for (int m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; ++m)
+			{
+				const Meshlet& meshlet = mesh.meshlets[m];
+				if (stats != NULL)
+					++stats->meshlets;
+				if (!MeshletVisible(meshlet, camera, selection.cullBackfaces, stats))
+					continue;
+
+				DrawCommand command = { DrawCommandKey(meshlet.texture,
+					camera.ToView(meshlet.center).z - meshlet.radius), &mesh, m, lodIndex };
+				commands.push_back(command);
+			}
+		}
+	}
+
+	// Material first, then front to back.
+	void Sort()
+	{
+		std::sort(commands.begin(), commands.end(), KeyLess());
+	}
+
+	// Draws the recorded commands in order.
+	template<typename VertexShaderT, typename PixelShaderT>
+	void Execute( const Camera& camera, const VertexShaderT& vs, PixelShaderT& ps, RenderTarget& target,
+		DrawStats* stats = NULL ) const
+	{
+		for (size_t c = 0; c < commands.size(); ++c)
+			Draw(commands[c], camera, vs, ps, target, stats);
+	}
+
+	// Like Execute(), but meshlets without a texture, which sort first, are
+	// drawn with the untextured shaders, whose vertex shader passes fewer
+	// varyings on. Whole levels can mix materials, so they always take the
+	// textured shaders.
+	template<typename UntexturedVertexShaderT, typename UntexturedPixelShaderT,
+		typename VertexShaderT, typename PixelShaderT>
+	void Execute( const Camera& camera, const UntexturedVertexShaderT& untexturedVs,
+		UntexturedPixelShaderT& untexturedPs, const VertexShaderT& vs, PixelShaderT& ps, RenderTarget& target,
+		DrawStats* stats = NULL ) const
+	{
+		for (size_t c = 0; c < commands.size(); ++c)
+		{
+			const DrawCommand& command = commands[c];
+			if (command.meshlet >= 0 && command.mesh->meshlets[command.meshlet].texture < 0)
+				Draw(command, camera, untexturedVs, untexturedPs, target, stats);
+			else
+				Draw(command, camera, vs, ps, target, stats);
+		}
+	}
+
+	int Size() const { return int(commands.size()); }
+
+private:
+	template<typename VertexShaderT, typename PixelShaderT>
+	static void Draw( const DrawCommand& command, const Camera& camera, const VertexShaderT& vs, PixelShaderT& ps,
+		RenderTarget& target, DrawStats* stats )
+	{
+		const IndexedMesh& mesh = *command.mesh;
+		if (command.meshlet < 0)
+		{
+			const MeshLod& lod = mesh.lods[command.lod];
+			DrawTriangles(mesh, lod.firstTriangle, lod.triangleCount, camera, vs, ps, target, stats);
+			if (stats != NULL)
+				stats->triangles += lod.triangleCount;
+			return;
+		}
+
+		const Meshlet& meshlet = mesh.meshlets[command.meshlet];
+		DrawMeshlet(mesh, meshlet, camera, vs, ps, target);
+		if (stats != NULL)
+		{
+			stats->vertices += meshlet.vertexCount;
+			stats->triangles += meshlet.triangleCount;
+		}
+	}
+
+	struct KeyLess
+	{
+		bool operator()( const DrawCommand& a, const DrawCommand& b ) const { return a.key < b.key; }
+	};
+
+	std::vector<DrawCommand> commands;
+};
+
+#endif
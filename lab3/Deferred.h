@@ -0,0 +1,324 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+// Deferred shading. The raster pass only fills a compact G-buffer (1/z,
+// octahedral normal, reflectance and material id; 12 bytes per pixel) and
+// a separate pass lights every visible pixel exactly once. The lighting
+// pass works on screen tiles in parallel: each tile gathers the lights
+// whose range reaches its bounding box and shades its pixels four at a
+// time, so the cost grows with the lights near each tile rather than
+// with the total light count.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+#include "SDL2Auxiliary.h"
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+#include "ShadowMap.h"
+#include "Simd.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "TileClear.h"
+
+// Lighting tiles coincide with the G-buffer's clear tiles. The workers
+// write them to the screen at once, so they must also cover whole screen
+// clear tiles.
+const int DEFERRED_TILE_SIZE = CLEAR_TILE_SIZE;
+static_assert(DEFERRED_TILE_SIZE % SDL2AUX_CLEAR_TILE_SIZE == 0,
+	"deferred tiles must align with SDL2Aux's clear tiles");
+const int MAX_LIGHTS = 1024;
+
+// Material ids stored in the top byte of the reflectance word.
+enum MaterialId
+{
+	MATERIAL_NONE = 0,
+	MATERIAL_DIFFUSE = 1
+};
+
+struct PointLight
+{
+	glm::vec3 position;
+	glm::vec3 power;
+	float range;		// Contribution is windowed to zero at this distance
+	bool castsShadows;	// Uses the cube shadow map (one light at most)
+};
+
+// Distance at which a light's irradiance P / (4 pi r^2) falls below
+// threshold in its brightest channel. The lighting pass fades lights out
+// smoothly towards this range so culling by it leaves no seams.
+inline float LightRange( const glm::vec3& power, float threshold = 1.0f / 256 )
+{
+	float p = std::max(power.x, std::max(power.y, power.z));
+	return std::sqrt(p / (4.0f * 3.14159265359f * threshold));
+}
+
+// Octahedral normal encoding, 16 bits per component.
+inline uint32_t PackNormal( const glm::vec3& n )
+{
+	glm::vec3 a = glm::abs(n);
+	float x = n.x / (a.x + a.y + a.z);
+	float y = n.y / (a.x + a.y + a.z);
+	if (n.z < 0)
+	{
+		float fx = (1.0f - glm::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float fy = (1.0f - glm::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+	uint32_t u = uint32_t((x * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	uint32_t v = uint32_t((y * 0.5f + 0.5f) * 65535.0f + 0.5f);
+	return u | (v << 16);
+}
+
+inline glm::vec3 UnpackNormal( uint32_t packed )
+{
+	float x = (packed & 0xffff) / 65535.0f * 2.0f - 1.0f;
+	float y = (packed >> 16) / 65535.0f * 2.0f - 1.0f;
+	float z = 1.0f - glm::abs(x) - glm::abs(y);
+	if (z < 0)
+	{
+		float fx = (1.0f - glm::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float fy = (1.0f - glm::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+	return glm::normalize(glm::vec3(x, y, z));
+}
+
+// 8-bit RGB reflectance with the material id in the top byte.
+inline uint32_t PackReflectance( const glm::vec3& rho, MaterialId material )
+{
+	uint32_t r = uint32_t(glm::clamp(rho.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+	uint32_t g = uint32_t(glm::clamp(rho.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+	uint32_t b = uint32_t(glm::clamp(rho.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return (uint32_t(material) << 24) | (r << 16) | (g << 8) | b;
+}
+
+class GBuffer
+{
+public:
+	GBuffer( int width, int height )
+		: width(width), height(height),
+		depth(width * height), normals(width * height), reflectance(width * height), tiles(width, height)
+	{
+	}
+
+	// Only depth needs clearing, and only tile by tile as it is drawn to;
+	// the other planes are read where 1/z > 0.
+	void Clear()
+	{
+		tiles.Clear();
+	}
+
+	RenderTarget Target()
+	{
+		RenderTarget target = { width, height, &depth[0], NULL, &tiles };
+		return target;
+	}
+
+	int width;
+	int height;
+	std::vector<float> depth;			// 1/z, 0 where nothing was drawn
+	std::vector<uint32_t> normals;		// PackNormal()
+	std::vector<uint32_t> reflectance;	// PackReflectance()
+	TileClear tiles;					// Depth is stale in tiles not Current()
+};
+
+// Pixel shader for the geometry pass: stores the surface, no lighting.
+// Expects TexCoordVertexShader varyings.
+struct GBufferShader
+{
+	GBuffer* gbuffer;
+	const std::vector<Texture>* textures;
+	uint32_t normal;
+	uint32_t reflectance;
+	glm::vec3 color;
+	const Texture* texture;
+
+	GBufferShader( GBuffer* gbuffer, const std::vector<Texture>* textures = NULL )
+		: gbuffer(gbuffer), textures(textures)
+	{
+	}
+
+	void BeginTriangle( const IndexedMesh& mesh, int triangle )
+	{
+		normal = PackNormal(mesh.normals[triangle]);
+		color = mesh.colors[triangle];
+		reflectance = PackReflectance(color, MATERIAL_DIFFUSE);
+		int id = mesh.textures[triangle];
+		texture = textures != NULL && id >= 0 ? &(*textures)[id] : NULL;
+	}
+
+	void operator()( const Quad<Varyings<2> >& quad )
+	{
+		Vec3x4 rho;
+		if (texture != NULL)
+			rho = Vec3x4::Set1(color) * texture->SampleQuad(quad.v[0], quad.v[1]);
+
+		for (int k = 0; k < 4; ++k)
+		{
+			if (!quad.Active(k))
+				continue;
+			int i = quad.Y(k) * gbuffer->width + quad.X(k);
+			gbuffer->normals[i] = normal;
+			gbuffer->reflectance[i] = texture != NULL ?
+				PackReflectance(rho.Lane(k), MATERIAL_DIFFUSE) : reflectance;
+		}
+	}
+};
+
+// Per-frame inputs of the lighting pass.
+struct DeferredLighting
+{
+	const std::vector<PointLight>* lights;
+	int lightCount;
+	glm::vec3 indirectLight;
+	const CubeShadowMap* shadowMap;
+};
+
+// Lights one tile of the G-buffer. The tile is shaded into a local block
+// and written to the screen in one go, empty pixels black, so the screen
+// needs no separate clear.
+inline void ShadeDeferredTile( const GBuffer& gbuffer, const Camera& camera,
+	const DeferredLighting& lighting, SDL2Aux* screen, int tile )
+{
+	const int N = DEFERRED_TILE_SIZE * DEFERRED_TILE_SIZE;
+	int tilesX = (gbuffer.width + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+	int x0 = (tile % tilesX) * DEFERRED_TILE_SIZE;
+	int y0 = (tile / tilesX) * DEFERRED_TILE_SIZE;
+	int x1 = std::min(x0 + DEFERRED_TILE_SIZE, gbuffer.width);
+	int y1 = std::min(y0 + DEFERRED_TILE_SIZE, gbuffer.height);
+	bool drawn = gbuffer.tiles.Current(tile);
+
+	// Reconstruct the visible surfaces of the tile in SoA form, compacted
+	// so the SIMD loop below never sees empty pixels.
+	float px[N], py[N], pz[N];
+	float nx[N], ny[N], nz[N];
+	float rr[N], rg[N], rb[N];
+	int pixel[N];					// Index in the tile's block
+	int count = 0;
+	glm::vec3 shaded[N];			// Black unless lit below
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			int i = y * gbuffer.width + x;
+			float zinv = drawn ? gbuffer.depth[i] : 0.0f;
+			if (zinv <= 0)
+				continue;
+
+			// At the pixel center, where the rasterizer sampled zinv.
+			float z = 1.0f / zinv;
+			glm::vec3 view((x + 0.5f - camera.width / 2) * z / camera.focalLength,
+				(y + 0.5f - camera.height / 2) * z / camera.focalLength, z);
+			glm::vec3 p = camera.position + camera.R * view;
+			glm::vec3 n = UnpackNormal(gbuffer.normals[i]);
+			uint32_t rho = gbuffer.reflectance[i];
+
+			px[count] = p.x; py[count] = p.y; pz[count] = p.z;
+			nx[count] = n.x; ny[count] = n.y; nz[count] = n.z;
+			rr[count] = ((rho >> 16) & 0xff) / 255.0f;
+			rg[count] = ((rho >> 8) & 0xff) / 255.0f;
+			rb[count] = (rho & 0xff) / 255.0f;
+			pixel[count] = (y - y0) * DEFERRED_TILE_SIZE + (x - x0);
+			boundsMin = glm::min(boundsMin, p);
+			boundsMax = glm::max(boundsMax, p);
+			++count;
+		}
+	}
+	if (count == 0)
+	{
+		screen->putTile(x0, y0, x1 - x0, y1 - y0, shaded, DEFERRED_TILE_SIZE);
+		return;
+	}
+
+	// Keep only the lights whose sphere of influence touches the tile's
+	// bounding box.
+	int culled[MAX_LIGHTS];
+	int culledCount = 0;
+	const std::vector<PointLight>& lights = *lighting.lights;
+	for (int l = 0; l < lighting.lightCount && culledCount < MAX_LIGHTS; ++l)
+	{
+		glm::vec3 d = glm::clamp(lights[l].position, boundsMin, boundsMax) - lights[l].position;
+		if (glm::dot(d, d) <= lights[l].range * lights[l].range)
+			culled[culledCount++] = l;
+	}
+
+	// Pad the last group of four with copies of the last pixel.
+	int padded = SimdPadded(count);
+	for (int i = count; i < padded; ++i)
+	{
+		px[i] = px[count - 1]; py[i] = py[count - 1]; pz[i] = pz[count - 1];
+		nx[i] = nx[count - 1]; ny[i] = ny[count - 1]; nz[i] = nz[count - 1];
+		rr[i] = rr[count - 1]; rg[i] = rg[count - 1]; rb[i] = rb[count - 1];
+	}
+
+	const Float4 zero = Float4::Set1(0.0f);
+	const Float4 one = Float4::Set1(1.0f);
+	const Float4 inv4Pi = Float4::Set1(1.0f / (4.0f * 3.14159265359f));
+	for (int i = 0; i < count; i += 4)
+	{
+		Float4 Px = Float4::Load(px + i), Py = Float4::Load(py + i), Pz = Float4::Load(pz + i);
+		Float4 Nx = Float4::Load(nx + i), Ny = Float4::Load(ny + i), Nz = Float4::Load(nz + i);
+		Float4 Dr = zero, Dg = zero, Db = zero;
+
+		for (int c = 0; c < culledCount; ++c)
+		{
+			const PointLight& light = lights[culled[c]];
+			Float4 rx = Float4::Set1(light.position.x) - Px;
+			Float4 ry = Float4::Set1(light.position.y) - Py;
+			Float4 rz = Float4::Set1(light.position.z) - Pz;
+			Float4 r2 = rx * rx + ry * ry + rz * rz;
+			Float4 cosine = Max(rx * Nx + ry * Ny + rz * Nz, zero) / Sqrt(r2);
+			// Window (1 - (r/range)^4)^2 so the light ends exactly at its range.
+			Float4 f = r2 * Float4::Set1(1.0f / (light.range * light.range));
+			Float4 window = Max(one - f * f, zero);
+			Float4 scale = cosine * inv4Pi / r2 * window * window;
+
+			if (light.castsShadows && lighting.shadowMap != NULL)
+			{
+				float visibility[4];
+				for (int k = 0; k < 4; ++k)
+				{
+					visibility[k] = cosine[k] > 0 ? lighting.shadowMap->Visibility(
+						glm::vec3(px[i + k], py[i + k], pz[i + k]),
+						glm::vec3(nx[i + k], ny[i + k], nz[i + k])) : 0.0f;
+				}
+				scale = scale * Float4::Load(visibility);
+			}
+
+			Dr = Dr + Float4::Set1(light.power.x) * scale;
+			Dg = Dg + Float4::Set1(light.power.y) * scale;
+			Db = Db + Float4::Set1(light.power.z) * scale;
+		}
+
+		Float4 R = Float4::Load(rr + i) * (Dr + Float4::Set1(lighting.indirectLight.x));
+		Float4 G = Float4::Load(rg + i) * (Dg + Float4::Set1(lighting.indirectLight.y));
+		Float4 B = Float4::Load(rb + i) * (Db + Float4::Set1(lighting.indirectLight.z));
+
+		int lanes = std::min(4, count - i);
+		for (int k = 0; k < lanes; ++k)
+			shaded[pixel[i + k]] = glm::vec3(R[k], G[k], B[k]);
+	}
+	screen->putTile(x0, y0, x1 - x0, y1 - y0, shaded, DEFERRED_TILE_SIZE);
+}
+
+// Lighting pass: shades every pixel covered in the G-buffer once.
+inline void ShadeDeferred( const GBuffer& gbuffer, const Camera& camera,
+	const DeferredLighting& lighting, SDL2Aux* screen, ThreadPool& pool )
+{
+	int tilesX = (gbuffer.width + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+	int tilesY = (gbuffer.height + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+	pool.ParallelFor(tilesX * tilesY, [&]( int tile )
+	{
+		ShadeDeferredTile(gbuffer, camera, lighting, screen, tile);
+	});
+}
+
+#endif
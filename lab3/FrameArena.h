@@ -0,0 +1,156 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+// Linear per-frame allocator used by the raster pipeline. All scratch
+// arrays (projected vertices, polygon rows, line pixels) are carved out of
+// one block and released together by Reset() at the start of each frame.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+// Number of global operator new calls so far on all threads but those that
+// set heapAllocationsIgnored (see AllocationCounter.cpp).
+extern std::atomic<size_t> heapAllocations;
+extern thread_local bool heapAllocationsIgnored;
+#endif
+
+// Non-owning view of a contiguous array, mostly so the raster functions
+// can keep their vector-like indexing when fed arena or stack memory.
+template<typename T>
+class Span
+{
+public:
+	Span() : ptr(NULL), count(0) {}
+	Span( T* ptr, int count ) : ptr(ptr), count(count) {}
+
+	T& operator[]( int i ) const { assert(i >= 0 && i < count); return ptr[i]; }
+	int size() const { return count; }
+	T* data() const { return ptr; }
+
+private:
+	T* ptr;
+	int count;
+};
+
+class FrameArena
+{
+public:
+	explicit FrameArena( size_t capacity )
+		: buffer(NULL), capacity(0), offset(0), spillBytes(0), spill(NULL), growCount(0)
+	{
+		Grow(capacity);
+	}
+
+	~FrameArena()
+	{
+		FreeSpill();
+		free(buffer);
+	}
+
+	// Returns count value-initialized elements. If the main block is
+	// exhausted the request is served from a heap spill block and the main
+	// block is grown on the next Reset(), so the arena settles after a few
+	// frames and steady-state frames never touch the heap.
+	template<typename T>
+	Span<T> Allocate( int count )
+	{
+		size_t bytes = sizeof(T) * size_t(count);
+		void* memory = AllocateBytes(bytes);
+		T* elements = static_cast<T*>(memory);
+		for (int i = 0; i < count; ++i)
+			new (elements + i) T();
+		return Span<T>(elements, count);
+	}
+
+	// Invalidates everything handed out since the last Reset().
+	void Reset()
+	{
+		if (spillBytes > 0)
+		{
+			size_t needed = offset + spillBytes;
+			FreeSpill();
+			Grow(2 * needed);
+		}
+		offset = 0;
+	}
+
+	size_t Used() const { return offset + spillBytes; }
+	size_t Capacity() const { return capacity; }
+
+	// Number of times the main block has been (re)allocated.
+	int GrowCount() const { return growCount; }
+
+	// True if the current frame needed memory beyond the main block.
+	bool Spilled() const { return spillBytes > 0; }
+
+private:
+	static const size_t ALIGNMENT = 16;
+
+	// Spill blocks are chained through a header placed in front of the data.
+	struct SpillBlock
+	{
+		SpillBlock* next;
+		size_t pad;
+	};
+
+	char* buffer;
+	size_t capacity;
+	size_t offset;
+	size_t spillBytes;
+	SpillBlock* spill;
+	int growCount;
+
+	void* AllocateBytes( size_t bytes )
+	{
+		bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		if (offset + bytes <= capacity)
+		{
+			void* p = buffer + offset;
+			offset += bytes;
+			return p;
+		}
+
+		SpillBlock* block = static_cast<SpillBlock*>(malloc(sizeof(SpillBlock) + bytes));
+		if (block == NULL)
+			throw std::bad_alloc();
+		block->next = spill;
+		spill = block;
+		spillBytes += bytes;
+		return block + 1;
+	}
+
+	void Grow( size_t newCapacity )
+	{
+		newCapacity = (newCapacity + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		if (newCapacity <= capacity)
+			return;
+		free(buffer);
+		// malloc only guarantees alignof(max_align_t), which is 16 on the
+		// platforms we build for.
+		buffer = static_cast<char*>(malloc(newCapacity));
+		if (buffer == NULL)
+			throw std::bad_alloc();
+		capacity = newCapacity;
+		++growCount;
+	}
+
+	void FreeSpill()
+	{
+		while (spill != NULL)
+		{
+			SpillBlock* next = spill->next;
+			free(spill);
+			spill = next;
+		}
+		spillBytes = 0;
+	}
+
+	FrameArena( const FrameArena& );
+	FrameArena& operator=( const FrameArena& );
+};
+
+#endif
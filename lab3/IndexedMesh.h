@@ -0,0 +1,493 @@
+#ifndef INDEXED_MESH_H
+#define INDEXED_MESH_H
+
+// Indexed triangle meshes for the rasterizer: a deduplicated vertex buffer,
+// a 32-bit index buffer, per-triangle flat attributes, a post-transform
+// vertex cache for the vertex stage and an offline index reordering pass
+// (Forsyth's linear-speed vertex cache optimisation).
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdint.h>
+#include <vector>
+#include "TestModel.h"
+
+// Triangle range of one level of detail of an object. error bounds the
+// distance to the full detail surface, in world units. Once meshlets are
+// built the range is covered by meshletCount of them.
+struct MeshLod
+{
+	int firstTriangle;
+	int triangleCount;
+	float error;
+	int firstMeshlet;
+	int meshletCount;
+};
+
+const int MAX_MESHLET_VERTICES = 64;
+const int MAX_MESHLET_TRIANGLES = 124;
+
+// Cluster of consecutive triangles drawn with its own small vertex list
+// (BuildMeshlets()). The bounding sphere and the cone around all triangle
+// normals (half angle with the given cosine and sine) let the vertex stage
+// skip meshlets that are off screen or facing away.
+struct Meshlet
+{
+	int firstTriangle;
+	int triangleCount;
+	int firstVertex;		// In IndexedMesh::meshletVertices
+	int vertexCount;
+	int texture;			// Shared by all its triangles, -1 for none
+	glm::vec3 center;
+	float radius;
+	glm::vec3 coneAxis;
+	float coneCos;
+	float coneSin;
+};
+
+// Levels below this error are treated as exact (rounding only).
+const float EXACT_LOD_ERROR = 1e-5f;
+
+// Part of the mesh drawn, or culled, as a unit, with its world-space
+// bounding box. Level 0 is full detail, the coarser levels follow it.
+struct MeshObject
+{
+	int firstLod;
+	int lodCount;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+};
+
+struct IndexedMesh
+{
+	std::vector<glm::vec3> positions;	// Vertex buffer, one entry per unique vertex
+	std::vector<glm::vec2> uvs;			// Per vertex
+	std::vector<uint32_t> indices;		// Three indices per triangle
+	std::vector<glm::vec3> normals;		// Per triangle
+	std::vector<glm::vec3> colors;		// Per triangle
+	std::vector<int> textures;			// Per triangle, -1 for none
+	std::vector<MeshObject> objects;
+	std::vector<MeshLod> lods;			// Triangle ranges, per object in order
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices;	// Vertex buffer indices, per meshlet
+	std::vector<uint8_t> meshletIndices;	// Like indices, but into the meshlet's vertices
+
+	int TriangleCount() const { return int(indices.size() / 3); }
+
+	const MeshLod& Lod( int object, int level ) const { return lods[objects[object].firstLod + level]; }
+
+	// Coarsest level of the object that still matches full detail.
+	int ExactLod( int object ) const
+	{
+		int level = 0;
+		while (level + 1 < objects[object].lodCount && Lod(object, level + 1).error <= EXACT_LOD_ERROR)
+			++level;
+		return level;
+	}
+};
+
+// Per-vertex attributes; corners equal in all of them share a vertex.
+struct VertexKey
+{
+	glm::vec3 position;
+	glm::vec2 uv;
+};
+
+// Orders vertices exactly (bitwise equal floats are the same vertex).
+struct VertexKeyLess
+{
+	bool operator()( const VertexKey& a, const VertexKey& b ) const
+	{
+		if (a.position.x != b.position.x) return a.position.x < b.position.x;
+		if (a.position.y != b.position.y) return a.position.y < b.position.y;
+		if (a.position.z != b.position.z) return a.position.z < b.position.z;
+		if (a.uv.x != b.uv.x) return a.uv.x < b.uv.x;
+		return a.uv.y < b.uv.y;
+	}
+};
+
+// Builds an indexed mesh from a triangle soup, merging vertices with equal
+// positions and texture coordinates. Normals, colors and textures are flat
+// in this renderer, so they stay per triangle and do not prevent sharing.
+// Each run of triangles with the same Triangle::object becomes an object
+// with a single level of detail.
+inline void BuildIndexedMesh( const std::vector<Triangle>& triangles, IndexedMesh& mesh )
+{
+	mesh.positions.clear();
+	mesh.uvs.clear();
+	mesh.indices.clear();
+	mesh.normals.clear();
+	mesh.colors.clear();
+	mesh.textures.clear();
+	mesh.objects.clear();
+	mesh.lods.clear();
+	mesh.meshlets.clear();
+	mesh.meshletVertices.clear();
+	mesh.meshletIndices.clear();
+	mesh.indices.reserve(3 * triangles.size());
+	mesh.normals.reserve(triangles.size());
+	mesh.colors.reserve(triangles.size());
+	mesh.textures.reserve(triangles.size());
+
+	std::map<VertexKey, uint32_t, VertexKeyLess> lookup;
+	for (size_t i = 0; i < triangles.size(); ++i)
+	{
+		const Triangle& triangle = triangles[i];
+		VertexKey corners[3] = {
+			{ triangle.v0, triangle.uv0 }, { triangle.v1, triangle.uv1 }, { triangle.v2, triangle.uv2 }
+		};
+		for (int k = 0; k < 3; ++k)
+		{
+			std::map<VertexKey, uint32_t, VertexKeyLess>::iterator it = lookup.find(corners[k]);
+			if (it == lookup.end())
+			{
+				uint32_t index = uint32_t(mesh.positions.size());
+				mesh.positions.push_back(corners[k].position);
+				mesh.uvs.push_back(corners[k].uv);
+				it = lookup.insert(std::make_pair(corners[k], index)).first;
+			}
+			mesh.indices.push_back(it->second);
+		}
+		mesh.normals.push_back(triangle.normal);
+		mesh.colors.push_back(triangle.color);
+		mesh.textures.push_back(triangle.texture);
+
+		if (i == 0 || triangle.object != triangles[i - 1].object)
+		{
+			MeshObject object = { int(mesh.lods.size()), 1, triangle.v0, triangle.v0 };
+			MeshLod lod = { int(i), 0, 0.0f, 0, 0 };
+			mesh.objects.push_back(object);
+			mesh.lods.push_back(lod);
+		}
+		MeshObject& object = mesh.objects.back();
+		++mesh.lods.back().triangleCount;
+		for (int k = 0; k < 3; ++k)
+		{
+			object.boundsMin = glm::min(object.boundsMin, corners[k].position);
+			object.boundsMax = glm::max(object.boundsMax, corners[k].position);
+		}
+	}
+}
+
+// Post-transform vertex cache: a small FIFO mapping vertex indices to the
+// output of the vertex shader, so shared vertices are transformed once
+// while they stay in the window.
+template<typename T, int SIZE = 32>
+class PostTransformCache
+{
+public:
+	PostTransformCache() { Clear(); }
+
+	void Clear()
+	{
+		for (int i = 0; i < SIZE; ++i)
+			tags[i] = INVALID;
+		next = 0;
+		hits = 0;
+		misses = 0;
+	}
+
+	// Returns the cached output for index, or NULL on a miss.
+	T* Lookup( uint32_t index )
+	{
+		for (int i = 0; i < SIZE; ++i)
+		{
+			if (tags[i] == index)
+			{
+				++hits;
+				return &values[i];
+			}
+		}
+		++misses;
+		return NULL;
+	}
+
+	// Claims the oldest slot for index; the caller fills in the value.
+	T& Insert( uint32_t index )
+	{
+		int slot = next;
+		next = (next + 1) % SIZE;
+		tags[slot] = index;
+		return values[slot];
+	}
+
+	int Hits() const { return hits; }
+	int Misses() const { return misses; }
+
+private:
+	static const uint32_t INVALID = 0xffffffffu;
+
+	uint32_t tags[SIZE];
+	T values[SIZE];
+	int next;
+	int hits;
+	int misses;
+};
+
+// Average cache miss ratio (transformed vertices per triangle) of the index
+// buffer replayed through a FIFO cache of the given size. 3.0 is the worst
+// case, 0.5 is about the best a regular grid can do.
+inline float AverageCacheMissRatio( const IndexedMesh& mesh, int cacheSize )
+{
+	if (mesh.indices.empty())
+		return 0;
+
+	std::vector<int> fifo(cacheSize, -1);
+	int next = 0;
+	int misses = 0;
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		int index = int(mesh.indices[i]);
+		if (std::find(fifo.begin(), fifo.end(), index) == fifo.end())
+		{
+			fifo[next] = index;
+			next = (next + 1) % cacheSize;
+			++misses;
+		}
+	}
+	return float(misses) / mesh.TriangleCount();
+}
+
+// Scores a vertex for Forsyth's algorithm from its position in the
+// simulated LRU cache and the number of triangles still using it.
+inline float ForsythVertexScore( int cachePosition, int remainingValence, int cacheSize )
+{
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	if (remainingValence == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// The three vertices of the last triangle are scored the same
+			// so the algorithm doesn't just strip along one direction.
+			score = LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			float scaler = 1.0f / (cacheSize - 3);
+			score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+
+	// Favour vertices with few triangles left so they can leave the cache.
+	score += VALENCE_BOOST_SCALE * std::pow(float(remainingValence), -VALENCE_BOOST_POWER);
+	return score;
+}
+
+// The distinct vertices of triangle t, in corner order; returns how many.
+// A degenerate triangle then appears once in each of its vertices'
+// adjacency lists.
+inline int DistinctCorners( const IndexedMesh& mesh, int t, int corners[3] )
+{
+	int n = 0;
+	for (int k = 0; k < 3; ++k)
+	{
+		int v = int(mesh.indices[3 * t + k]);
+		if (std::find(corners, corners + n, v) == corners + n)
+			corners[n++] = v;
+	}
+	return n;
+}
+
+// Appends the triangles [first, first + count) of mesh to order in the
+// sequence Forsyth's algorithm picks for an LRU cache of cacheSize.
+inline void ForsythOrder( const IndexedMesh& mesh, int first, int count, int cacheSize, std::vector<int>& order )
+{
+	const int end = first + count;
+	const int vertexCount = int(mesh.positions.size());
+	if (count == 0)
+		return;
+
+	// Vertex -> triangle adjacency in compressed rows.
+	std::vector<int> valence(vertexCount, 0);
+	int corners[3];
+	for (int t = first; t < end; ++t)
+	{
+		int n = DistinctCorners(mesh, t, corners);
+		for (int k = 0; k < n; ++k)
+			++valence[corners[k]];
+	}
+	std::vector<int> adjacencyStart(vertexCount + 1, 0);
+	for (int v = 0; v < vertexCount; ++v)
+		adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+	std::vector<int> adjacency(3 * count);
+	std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (int t = first; t < end; ++t)
+	{
+		int n = DistinctCorners(mesh, t, corners);
+		for (int k = 0; k < n; ++k)
+			adjacency[fill[corners[k]]++] = t;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (int v = 0; v < vertexCount; ++v)
+		vertexScore[v] = ForsythVertexScore(-1, valence[v], cacheSize);
+
+	std::vector<float> triangleScore(count);
+	std::vector<bool> emitted(count, false);
+	for (int t = first; t < end; ++t)
+	{
+		triangleScore[t - first] = vertexScore[mesh.indices[3 * t]] +
+			vertexScore[mesh.indices[3 * t + 1]] +
+			vertexScore[mesh.indices[3 * t + 2]];
+	}
+
+	// Simulated LRU cache. It briefly holds up to three extra entries while
+	// a triangle is added so evicted vertices can be rescored.
+	std::vector<int> cache;
+	cache.reserve(cacheSize + 3);
+
+	int best = first + int(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+	int scanStart = first;
+	while (best >= 0)
+	{
+		emitted[best - first] = true;
+		order.push_back(best);
+
+		// Move the triangle's vertices to the front of the cache and drop
+		// its contribution from their valence.
+		std::vector<int> newCache;
+		newCache.reserve(cacheSize + 3);
+		int n = DistinctCorners(mesh, best, corners);
+		for (int k = 0; k < n; ++k)
+		{
+			int v = corners[k];
+			newCache.push_back(v);
+			--valence[v];
+			int* list = &adjacency[adjacencyStart[v]];
+			int* listEnd = list + valence[v] + 1;
+			std::iter_swap(std::find(list, listEnd, best), listEnd - 1);
+		}
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			if (std::find(newCache.begin(), newCache.end(), cache[i]) == newCache.end())
+				newCache.push_back(cache[i]);
+		}
+		for (size_t i = cacheSize; i < newCache.size(); ++i)
+		{
+			cachePosition[newCache[i]] = -1;
+			vertexScore[newCache[i]] = ForsythVertexScore(-1, valence[newCache[i]], cacheSize);
+		}
+		if (int(newCache.size()) > cacheSize)
+			newCache.resize(cacheSize);
+		cache.swap(newCache);
+
+		// Rescore the cached vertices and the triangles that touch them,
+		// picking the next triangle among those.
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			int v = cache[i];
+			cachePosition[v] = int(i);
+			vertexScore[v] = ForsythVertexScore(int(i), valence[v], cacheSize);
+		}
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			int v = cache[i];
+			for (int a = adjacencyStart[v]; a < adjacencyStart[v] + valence[v]; ++a)
+			{
+				int t = adjacency[a];
+				float score = vertexScore[mesh.indices[3 * t]] +
+					vertexScore[mesh.indices[3 * t + 1]] +
+					vertexScore[mesh.indices[3 * t + 2]];
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+
+		// Nothing left around the cache: restart from the best remaining
+		// triangle anywhere in the range.
+		if (best < 0)
+		{
+			for (int t = scanStart; t < end; ++t)
+			{
+				if (emitted[t - first])
+				{
+					if (t == scanStart)
+						++scanStart;
+					continue;
+				}
+				float score = vertexScore[mesh.indices[3 * t]] +
+					vertexScore[mesh.indices[3 * t + 1]] +
+					vertexScore[mesh.indices[3 * t + 2]];
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+	}
+}
+
+// Reorders the triangles of mesh (indices and per-triangle attributes) to
+// maximise post-transform cache hits, then renumbers the vertex buffer in
+// first-use order so vertex fetches are sequential too. Triangles stay
+// within their level of detail.
+inline void OptimizeVertexCache( IndexedMesh& mesh, int cacheSize = 32 )
+{
+	const int triangleCount = mesh.TriangleCount();
+	const int vertexCount = int(mesh.positions.size());
+	if (triangleCount == 0)
+		return;
+
+	std::vector<int> order;
+	order.reserve(triangleCount);
+	for (size_t l = 0; l < mesh.lods.size(); ++l)
+	{
+		int start = int(order.size());
+		ForsythOrder(mesh, mesh.lods[l].firstTriangle, mesh.lods[l].triangleCount, cacheSize, order);
+		mesh.lods[l].firstTriangle = start;
+	}
+
+	// Apply the new triangle order and renumber vertices by first use.
+	std::vector<uint32_t> remap(vertexCount, 0xffffffffu);
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	positions.reserve(vertexCount);
+	uvs.reserve(vertexCount);
+	std::vector<uint32_t> indices(mesh.indices.size());
+	std::vector<glm::vec3> normals(triangleCount);
+	std::vector<glm::vec3> colors(triangleCount);
+	std::vector<int> textures(triangleCount);
+	for (int i = 0; i < triangleCount; ++i)
+	{
+		int t = order[i];
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = mesh.indices[3 * t + k];
+			if (remap[v] == 0xffffffffu)
+			{
+				remap[v] = uint32_t(positions.size());
+				positions.push_back(mesh.positions[v]);
+				uvs.push_back(mesh.uvs[v]);
+			}
+			indices[3 * i + k] = remap[v];
+		}
+		normals[i] = mesh.normals[t];
+		colors[i] = mesh.colors[t];
+		textures[i] = mesh.textures[t];
+	}
+	mesh.positions.swap(positions);
+	mesh.uvs.swap(uvs);
+	mesh.indices.swap(indices);
+	mesh.normals.swap(normals);
+	mesh.colors.swap(colors);
+	mesh.textures.swap(textures);
+}
+
+#endif
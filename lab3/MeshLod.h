@@ -0,0 +1,481 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+// Levels of detail. GenerateLods() simplifies every object of a mesh at
+// load time into a chain of coarser triangle ranges with quadric error
+// metrics (Garland and Heckbert), collapsing edges onto one of their
+// endpoints so all levels share the vertex buffer. LodSelector picks a
+// level per object and frame from its error projected to pixels with the
+// camera's focal length.
+//
+// Collapses keep attribute seams intact: every vertex sharing the removed
+// position must have an edge to the kept one, and mesh borders and seams
+// carry constraint planes so they only simplify along themselves.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdint.h>
+#include <vector>
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+
+// Collapses stop once they would move the surface by more than this
+// fraction of the object's bounding radius.
+const float LOD_MAX_ERROR = 0.25f;
+
+// Splits every triangle into n x n smaller ones with interpolated texture
+// coordinates, e.g. to give the simplifier dense meshes to work on. Shared
+// edges split at bitwise equal positions, so the result stays watertight.
+inline void SubdivideTriangles( std::vector<Triangle>& triangles, int n )
+{
+	if (n <= 1)
+		return;
+
+	std::vector<Triangle> result;
+	result.reserve(triangles.size() * n * n);
+	for (size_t t = 0; t < triangles.size(); ++t)
+	{
+		const Triangle& s = triangles[t];
+		for (int j = 0; j < n; ++j)
+		{
+			for (int k = 0; j + k < n; ++k)
+			{
+				// Grid points have barycentric weights (i, j, k) / n.
+				int i = n - j - k;
+				int corners[2][3][3] = {
+					{ { i, j, k }, { i - 1, j + 1, k }, { i - 1, j, k + 1 } },
+					{ { i - 1, j + 1, k }, { i - 2, j + 1, k + 1 }, { i - 1, j, k + 1 } }
+				};
+				for (int c = 0; c < (i >= 2 ? 2 : 1); ++c)
+				{
+					glm::vec3 p[3];
+					glm::vec2 uv[3];
+					for (int m = 0; m < 3; ++m)
+					{
+						const int* w = corners[c][m];
+						p[m] = (s.v0 * float(w[0]) + s.v1 * float(w[1]) + s.v2 * float(w[2])) / float(n);
+						uv[m] = (s.uv0 * float(w[0]) + s.uv1 * float(w[1]) + s.uv2 * float(w[2])) / float(n);
+					}
+					Triangle triangle(p[0], p[1], p[2], s.color, s.texture);
+					triangle.uv0 = uv[0];
+					triangle.uv1 = uv[1];
+					triangle.uv2 = uv[2];
+					triangle.normal = s.normal;
+					triangle.object = s.object;
+					result.push_back(triangle);
+				}
+			}
+		}
+	}
+	triangles.swap(result);
+}
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix.
+struct Quadric
+{
+	double m[10];	// xx xy xz xw yy yz yw zz zw ww
+
+	Quadric() { std::fill(m, m + 10, 0.0); }
+
+	// The plane n.p + d = 0 with unit n.
+	static Quadric Plane( const glm::vec3& n, float d )
+	{
+		Quadric q;
+		double v[4] = { n.x, n.y, n.z, d };
+		int k = 0;
+		for (int i = 0; i < 4; ++i)
+			for (int j = i; j < 4; ++j)
+				q.m[k++] = v[i] * v[j];
+		return q;
+	}
+
+	Quadric& operator+=( const Quadric& q )
+	{
+		for (int i = 0; i < 10; ++i)
+			m[i] += q.m[i];
+		return *this;
+	}
+
+	double Error( const glm::vec3& p ) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x +
+			m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y +
+			m[7] * z * z + 2 * m[8] * z + m[9];
+	}
+};
+
+// Edge collapse of all vertices at one position onto another.
+struct LodCollapse
+{
+	int from;		// Position groups, see GenerateLods()
+	int to;
+	double cost;
+
+	bool operator<( const LodCollapse& c ) const { return cost < c.cost; }
+};
+
+// Simplification state of one object: its live triangles as vertex
+// indices plus the full detail triangle each came from.
+class LodSimplifier
+{
+public:
+	LodSimplifier( const IndexedMesh& mesh, const std::vector<int>& group, const MeshLod& lod )
+		: mesh(mesh), group(group), quadrics(mesh.positions.size()), maxCost(0)
+	{
+		std::map<std::pair<uint32_t, uint32_t>, int> edges;
+		for (int t = lod.firstTriangle; t < lod.firstTriangle + lod.triangleCount; ++t)
+		{
+			const uint32_t* v = &mesh.indices[3 * t];
+			indices.insert(indices.end(), v, v + 3);
+			sources.push_back(t);
+
+			const glm::vec3& n = mesh.normals[t];
+			Quadric plane = Quadric::Plane(n, -glm::dot(n, mesh.positions[v[0]]));
+			for (int k = 0; k < 3; ++k)
+			{
+				quadrics[group[v[k]]] += plane;
+				edges[std::make_pair(v[k], v[(k + 1) % 3])] = t;
+			}
+		}
+
+		// Borders, seams and material boundaries get a plane through the
+		// edge, perpendicular to the triangle.
+		for (std::map<std::pair<uint32_t, uint32_t>, int>::iterator it = edges.begin(); it != edges.end(); ++it)
+		{
+			int t = it->second;
+			std::map<std::pair<uint32_t, uint32_t>, int>::iterator twin =
+				edges.find(std::make_pair(it->first.second, it->first.first));
+			if (twin != edges.end() && mesh.colors[twin->second] == mesh.colors[t] &&
+				mesh.textures[twin->second] == mesh.textures[t])
+				continue;
+
+			const glm::vec3& p = mesh.positions[it->first.first];
+			const glm::vec3& q = mesh.positions[it->first.second];
+			glm::vec3 n = glm::cross(q - p, mesh.normals[t]);
+			if (glm::dot(n, n) == 0)
+				continue;
+			n = glm::normalize(n);
+			Quadric plane = Quadric::Plane(n, -glm::dot(n, p));
+			quadrics[group[it->first.first]] += plane;
+			quadrics[group[it->first.second]] += plane;
+		}
+	}
+
+	int TriangleCount() const { return int(sources.size()); }
+
+	// Largest error of the collapses so far, in world units.
+	float Error() const { return float(std::sqrt(maxCost)); }
+
+	// Collapses edges, cheapest first, until at most target triangles are
+	// left or the next collapse would cost more than costLimit.
+	void Simplify( int target, double costLimit )
+	{
+		while (TriangleCount() > target)
+		{
+			BuildAdjacency();
+
+			// The cheaper valid direction of every edge.
+			std::vector<LodCollapse> collapses;
+			for (int t = 0; t < TriangleCount(); ++t)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					int a = group[indices[3 * t + k]];
+					int b = group[indices[3 * t + (k + 1) % 3]];
+					if (a >= b)
+						continue;
+					Quadric q = quadrics[a];
+					q += quadrics[b];
+					LodCollapse ab = { a, b, q.Error(mesh.positions[b]) };
+					LodCollapse ba = { b, a, q.Error(mesh.positions[a]) };
+					if (ba.cost < ab.cost)
+						std::swap(ab, ba);
+					if (Collapse(ab, NULL, NULL))
+						collapses.push_back(ab);
+					else if (Collapse(ba, NULL, NULL))
+						collapses.push_back(ba);
+				}
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end());
+
+			// A collapse removes about two triangles. Passes only take
+			// collapses close in cost to the ones needed to reach target,
+			// so a cheap collapse blocked this pass is not passed over for
+			// an expensive one.
+			size_t goal = std::min(collapses.size(), size_t(TriangleCount() - target + 1) / 2 + 1);
+			double passLimit = std::min(costLimit, std::max(collapses[goal - 1].cost, 0.0) * 1.5);
+
+			// One collapse per neighbourhood and pass, so the checks below
+			// see the current mesh.
+			std::vector<bool> locked(mesh.positions.size(), false);
+			std::vector<bool> dead(TriangleCount(), false);
+			int live = TriangleCount();
+			int collapsed = 0;
+			for (size_t c = 0; c < collapses.size() && live > target; ++c)
+			{
+				const LodCollapse& collapse = collapses[c];
+				if (collapse.cost > passLimit && (collapsed > 0 || collapse.cost > costLimit))
+					break;
+				if (locked[collapse.from] || locked[collapse.to] || !Collapse(collapse, &dead, &live))
+					continue;
+
+				for (int g = 0; g < 2; ++g)
+				{
+					const std::vector<int>& ring = incident[g == 0 ? collapse.from : collapse.to];
+					for (size_t i = 0; i < ring.size(); ++i)
+						for (int k = 0; k < 3; ++k)
+							locked[group[indices[3 * ring[i] + k]]] = true;
+				}
+				quadrics[collapse.to] += quadrics[collapse.from];
+				maxCost = std::max(maxCost, collapse.cost);
+				++collapsed;
+			}
+
+			Compact(dead);
+			if (collapsed == 0)
+				break;
+		}
+	}
+
+	// Appends the live triangles to mesh as a new level.
+	void Append( IndexedMesh& out, MeshLod& lod ) const
+	{
+		lod.firstTriangle = out.TriangleCount();
+		lod.triangleCount = TriangleCount();
+		lod.error = Error();
+		for (int t = 0; t < TriangleCount(); ++t)
+		{
+			const uint32_t* v = &indices[3 * t];
+			out.indices.insert(out.indices.end(), v, v + 3);
+			glm::vec3 e1 = out.positions[v[1]] - out.positions[v[0]];
+			glm::vec3 e2 = out.positions[v[2]] - out.positions[v[0]];
+			out.normals.push_back(glm::normalize(glm::cross(e2, e1)));
+			out.colors.push_back(out.colors[sources[t]]);
+			out.textures.push_back(out.textures[sources[t]]);
+		}
+	}
+
+private:
+	const IndexedMesh& mesh;
+	const std::vector<int>& group;
+	std::vector<Quadric> quadrics;		// Per position group
+	std::vector<uint32_t> indices;
+	std::vector<int> sources;
+	std::vector<std::vector<int> > incident;	// Live triangles per position group
+	double maxCost;
+
+	void BuildAdjacency()
+	{
+		incident.assign(mesh.positions.size(), std::vector<int>());
+		for (int t = 0; t < TriangleCount(); ++t)
+			for (int k = 0; k < 3; ++k)
+				incident[group[indices[3 * t + k]]].push_back(t);
+	}
+
+	// Moves every vertex at position group from onto a vertex at to that it
+	// shares an edge with. Fails if one has none (the collapse would tear a
+	// seam) or a triangle would flip. Only checks if dead is NULL.
+	bool Collapse( const LodCollapse& collapse, std::vector<bool>* dead, int* live )
+	{
+		const std::vector<int>& ring = incident[collapse.from];
+		std::vector<std::pair<uint32_t, uint32_t> > moves;
+		for (size_t i = 0; i < ring.size(); ++i)
+		{
+			const uint32_t* v = &indices[3 * ring[i]];
+			for (int k = 0; k < 3; ++k)
+			{
+				if (group[v[k]] != collapse.from)
+					continue;
+				for (int m = 0; m < 3; ++m)
+				{
+					if (group[v[m]] == collapse.to)
+						moves.push_back(std::make_pair(v[k], v[m]));
+				}
+			}
+		}
+
+		glm::vec3 target = mesh.positions[collapse.to];
+		for (size_t i = 0; i < ring.size(); ++i)
+		{
+			const uint32_t* v = &indices[3 * ring[i]];
+			bool collapsing = false;
+			for (int k = 0; k < 3; ++k)
+				collapsing |= group[v[k]] == collapse.to;
+			if (collapsing)
+				continue;
+
+			glm::vec3 before[3], after[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				before[k] = after[k] = mesh.positions[v[k]];
+				if (group[v[k]] != collapse.from)
+					continue;
+				if (Find(moves, v[k]) == NULL)
+					return false;
+				after[k] = target;
+			}
+			glm::vec3 nb = glm::cross(before[2] - before[0], before[1] - before[0]);
+			glm::vec3 na = glm::cross(after[2] - after[0], after[1] - after[0]);
+			if (glm::dot(nb, na) <= 0)
+				return false;
+		}
+		if (dead == NULL)
+			return true;
+
+		for (size_t i = 0; i < ring.size(); ++i)
+		{
+			uint32_t* v = &indices[3 * ring[i]];
+			bool collapsing = false;
+			for (int k = 0; k < 3; ++k)
+				collapsing |= group[v[k]] == collapse.to;
+			if (collapsing)
+			{
+				(*dead)[ring[i]] = true;
+				--*live;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				if (group[v[k]] == collapse.from)
+					v[k] = *Find(moves, v[k]);
+			}
+		}
+		return true;
+	}
+
+	static const uint32_t* Find( const std::vector<std::pair<uint32_t, uint32_t> >& moves, uint32_t from )
+	{
+		for (size_t i = 0; i < moves.size(); ++i)
+		{
+			if (moves[i].first == from)
+				return &moves[i].second;
+		}
+		return NULL;
+	}
+
+	void Compact( const std::vector<bool>& dead )
+	{
+		size_t kept = 0;
+		for (size_t t = 0; t < sources.size(); ++t)
+		{
+			if (dead[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+				indices[3 * kept + k] = indices[3 * t + k];
+			sources[kept++] = sources[t];
+		}
+		indices.resize(3 * kept);
+		sources.resize(kept);
+	}
+};
+
+// Builds up to maxLevels levels of detail per object, each with about half
+// the triangles of the one before, stopping once an object no longer
+// simplifies within LOD_MAX_ERROR. Run before OptimizeVertexCache().
+inline void GenerateLods( IndexedMesh& mesh, int maxLevels = 8 )
+{
+	// Vertices at the same position (seams) form one group, numbered by
+	// their first vertex.
+	std::vector<int> group(mesh.positions.size());
+	std::map<VertexKey, int, VertexKeyLess> first;
+	for (size_t v = 0; v < mesh.positions.size(); ++v)
+	{
+		VertexKey key = { mesh.positions[v], glm::vec2(0.0f) };
+		group[v] = first.insert(std::make_pair(key, int(v))).first->second;
+	}
+
+	std::vector<MeshLod> lods;
+	for (size_t o = 0; o < mesh.objects.size(); ++o)
+	{
+		MeshObject& object = mesh.objects[o];
+		MeshLod full = mesh.lods[object.firstLod];
+		object.firstLod = int(lods.size());
+		object.lodCount = 1;
+		lods.push_back(full);
+
+		float radius = 0.5f * glm::length(object.boundsMax - object.boundsMin);
+		double costLimit = double(LOD_MAX_ERROR * radius) * (LOD_MAX_ERROR * radius);
+		LodSimplifier simplifier(mesh, group, full);
+		while (object.lodCount < maxLevels)
+		{
+			int before = simplifier.TriangleCount();
+			simplifier.Simplify(before / 2, costLimit);
+			if (simplifier.TriangleCount() * 10 > before * 9)
+				break;
+
+			MeshLod lod = { 0, 0, 0.0f, 0, 0 };
+			simplifier.Append(mesh, lod);
+			lods.push_back(lod);
+			++object.lodCount;
+		}
+	}
+	mesh.lods.swap(lods);
+}
+
+// Picks a level of detail per object each frame: the coarsest one whose
+// error, projected at the object's nearest point, stays under threshold
+// pixels. Objects only move to a coarser level once it is well under the
+// threshold, so they do not flicker between two levels at one distance.
+class LodSelector
+{
+public:
+	explicit LodSelector( float threshold = 0.5f, float hysteresis = 0.75f )
+		: threshold(threshold), hysteresis(hysteresis)
+	{
+	}
+
+	void Init( const IndexedMesh& mesh )
+	{
+		levels.assign(mesh.objects.size(), 0);
+	}
+
+	void Select( const IndexedMesh& mesh, const Camera& camera )
+	{
+		for (size_t o = 0; o < mesh.objects.size(); ++o)
+		{
+			const MeshObject& object = mesh.objects[o];
+			glm::vec3 nearest = glm::clamp(camera.position, object.boundsMin, object.boundsMax);
+			float distance = glm::length(nearest - camera.position);
+
+			int& level = levels[o];
+			while (level > 0 && ProjectedError(mesh.Lod(int(o), level).error, distance, camera) > threshold)
+				--level;
+			while (level + 1 < object.lodCount &&
+				ProjectedError(mesh.Lod(int(o), level + 1).error, distance, camera) <= threshold * hysteresis)
+				++level;
+		}
+	}
+
+	// One level per mesh object, for DrawIndexedMesh().
+	const int* Levels() const { return levels.empty() ? NULL : &levels[0]; }
+
+	// Triangles drawn at the current levels.
+	int TriangleCount( const IndexedMesh& mesh ) const
+	{
+		int count = 0;
+		for (size_t o = 0; o < levels.size(); ++o)
+			count += mesh.Lod(int(o), levels[o]).triangleCount;
+		return count;
+	}
+
+private:
+	float threshold;
+	float hysteresis;
+	std::vector<int> levels;
+
+	static float ProjectedError( float error, float distance, const Camera& camera )
+	{
+		if (error <= EXACT_LOD_ERROR)
+			return 0;
+		if (distance <= NEAR_PLANE)
+			return 1e30f;
+		return camera.focalLength * error / distance;
+	}
+};
+
+#endif
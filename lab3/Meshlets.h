@@ -0,0 +1,157 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+// Splits the levels of detail of a mesh into meshlets: clusters of at most
+// MAX_MESHLET_VERTICES vertices and MAX_MESHLET_TRIANGLES triangles whose
+// normals stay within MESHLET_MAX_ANGLE of the first one, so the normal
+// cones are narrow enough to cull, and which share one texture, so each
+// meshlet is a single material for draw sorting. Clusters grow across
+// shared vertices, preferring triangles that add the fewest new ones.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+#include "IndexedMesh.h"
+
+const float MESHLET_MAX_ANGLE = 0.785398f;	// 45 degrees
+
+// Bounding sphere and normal cone of a meshlet whose triangles and
+// vertices are filled in.
+inline void ComputeMeshletBounds( const IndexedMesh& mesh, Meshlet& meshlet )
+{
+	glm::vec3 lo = mesh.positions[mesh.meshletVertices[meshlet.firstVertex]];
+	glm::vec3 hi = lo;
+	for (int v = 1; v < meshlet.vertexCount; ++v)
+	{
+		const glm::vec3& p = mesh.positions[mesh.meshletVertices[meshlet.firstVertex + v]];
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	meshlet.center = 0.5f * (lo + hi);
+	meshlet.radius = 0;
+	for (int v = 0; v < meshlet.vertexCount; ++v)
+	{
+		const glm::vec3& p = mesh.positions[mesh.meshletVertices[meshlet.firstVertex + v]];
+		meshlet.radius = std::max(meshlet.radius, glm::length(p - meshlet.center));
+	}
+
+	glm::vec3 sum(0.0f);
+	for (int t = meshlet.firstTriangle; t < meshlet.firstTriangle + meshlet.triangleCount; ++t)
+		sum += mesh.normals[t];
+	meshlet.coneAxis = glm::dot(sum, sum) > 0 ? glm::normalize(sum) : mesh.normals[meshlet.firstTriangle];
+	meshlet.coneCos = 1;
+	for (int t = meshlet.firstTriangle; t < meshlet.firstTriangle + meshlet.triangleCount; ++t)
+		meshlet.coneCos = std::min(meshlet.coneCos, glm::dot(meshlet.coneAxis, mesh.normals[t]));
+	meshlet.coneCos = std::max(meshlet.coneCos, -1.0f);
+	meshlet.coneSin = std::sqrt(std::max(0.0f, 1 - meshlet.coneCos * meshlet.coneCos));
+}
+
+// Builds the meshlets of every level of detail, reordering the triangles
+// within each level so every meshlet is a consecutive range. Run after
+// GenerateLods() and OptimizeVertexCache().
+inline void BuildMeshlets( IndexedMesh& mesh )
+{
+	const int vertexCount = int(mesh.positions.size());
+	const float minCos = std::cos(MESHLET_MAX_ANGLE);
+	mesh.meshlets.clear();
+	mesh.meshletVertices.clear();
+	mesh.meshletIndices.assign(mesh.indices.size(), 0);
+
+	std::vector<uint32_t> indices(mesh.indices);
+	std::vector<glm::vec3> normals(mesh.normals);
+	std::vector<glm::vec3> colors(mesh.colors);
+	std::vector<int> textures(mesh.textures);
+	std::vector<std::vector<int> > adjacency(vertexCount);
+	std::vector<int> local(vertexCount, -1);	// Index in the current meshlet
+
+	for (size_t l = 0; l < mesh.lods.size(); ++l)
+	{
+		MeshLod& lod = mesh.lods[l];
+		const int first = lod.firstTriangle;
+		const int end = first + lod.triangleCount;
+		for (int t = first; t < end; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[indices[3 * t + k]].push_back(t);
+
+		lod.firstMeshlet = int(mesh.meshlets.size());
+		std::vector<bool> assigned(lod.triangleCount, false);
+		int next = first;		// Output position of the next triangle
+		int seed = first;
+		while (next < end)
+		{
+			while (assigned[seed - first])
+				++seed;
+
+			Meshlet meshlet = Meshlet();
+			meshlet.firstTriangle = next;
+			meshlet.firstVertex = int(mesh.meshletVertices.size());
+			meshlet.texture = textures[seed];
+			glm::vec3 seedNormal = normals[seed];
+
+			int t = seed;
+			while (t >= 0)
+			{
+				assigned[t - first] = true;
+				for (int k = 0; k < 3; ++k)
+				{
+					uint32_t v = indices[3 * t + k];
+					if (local[v] < 0)
+					{
+						local[v] = meshlet.vertexCount++;
+						mesh.meshletVertices.push_back(v);
+					}
+					mesh.indices[3 * next + k] = v;
+					mesh.meshletIndices[3 * next + k] = uint8_t(local[v]);
+				}
+				mesh.normals[next] = normals[t];
+				mesh.colors[next] = colors[t];
+				mesh.textures[next] = textures[t];
+				++next;
+				if (++meshlet.triangleCount == MAX_MESHLET_TRIANGLES)
+					break;
+
+				// Next: the neighbouring triangle adding the fewest vertices
+				// that still fits, first in order on ties.
+				t = -1;
+				int bestNew = 4;
+				for (int v = meshlet.firstVertex; v < int(mesh.meshletVertices.size()); ++v)
+				{
+					const std::vector<int>& around = adjacency[mesh.meshletVertices[v]];
+					for (size_t i = 0; i < around.size(); ++i)
+					{
+						int u = around[i];
+						if (assigned[u - first] || textures[u] != meshlet.texture ||
+							glm::dot(normals[u], seedNormal) < minCos)
+						{
+							continue;
+						}
+						int added = 0;
+						for (int k = 0; k < 3; ++k)
+							added += local[indices[3 * u + k]] < 0;
+						if (meshlet.vertexCount + added > MAX_MESHLET_VERTICES)
+							continue;
+						if (added < bestNew || (added == bestNew && u < t))
+						{
+							bestNew = added;
+							t = u;
+						}
+					}
+				}
+			}
+
+			for (int v = meshlet.firstVertex; v < int(mesh.meshletVertices.size()); ++v)
+				local[mesh.meshletVertices[v]] = -1;
+			ComputeMeshletBounds(mesh, meshlet);
+			mesh.meshlets.push_back(meshlet);
+		}
+		lod.meshletCount = int(mesh.meshlets.size()) - lod.firstMeshlet;
+
+		for (int t = first; t < end; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[indices[3 * t + k]].clear();
+	}
+}
+
+#endif
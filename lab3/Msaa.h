@@ -0,0 +1,229 @@
+#ifndef MSAA_H
+#define MSAA_H
+
+// Multisample anti-aliasing. The rasterizer tests coverage and depth at 4
+// or 8 sample positions per pixel but runs the pixel shader once per pixel
+// and triangle; the shaded color goes to every sample it covered. Resolve()
+// averages the samples into the screen.
+//
+// Storage is compressed: a pixel only covered by whole triangles keeps a
+// single depth and color. It is expanded into per-sample depths and colors
+// the first time a triangle covers it partially, so only edge pixels pay
+// for the samples. Expanded pixels come from a pool sized from the previous
+// frame's edge pixel count. Clearing is per tile, as for the depth buffer
+// (TileClear.h): a tile is reset when a triangle first reaches it, and
+// resolves to black if none does.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "SDL2Auxiliary.h"
+#include "TileClear.h"
+
+const int MAX_MSAA_SAMPLES = 8;
+
+class MsaaBuffer
+{
+public:
+	// sampleCount is 4 (rotated grid) or 8 (the usual 8x pattern).
+	MsaaBuffer( int width, int height, int sampleCount )
+		: width(width), height(height), sampleCount(sampleCount),
+		depth(width * height), color(width * height), expanded(width * height),
+		tiles(width, height), poolCapacity(0), poolSize(0), overflowed(false)
+	{
+		// Sample positions relative to the pixel center, in 1/16 pixel.
+		static const int pattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+		static const int pattern8[8][2] = {
+			{ 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 }
+		};
+		offsets = sampleCount == 8 ? pattern8 : pattern4;
+		fullMask = (1 << sampleCount) - 1;
+		Reserve(width * height / 16);
+	}
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int SampleCount() const { return sampleCount; }
+	int FullMask() const { return fullMask; }
+	int SampleX( int s ) const { return offsets[s][0]; }
+	int SampleY( int s ) const { return offsets[s][1]; }
+
+	// Pixels expanded to per-sample storage since the last Clear().
+	int EdgePixelCount() const { return poolSize; }
+
+	// Resets every pixel to a single empty sample. Grows the pool if the
+	// last frame ran out of it or came close.
+	void Clear()
+	{
+		if (overflowed || poolSize * 4 > poolCapacity * 3)
+			Reserve(std::min(2 * poolCapacity, width * height));
+		tiles.Clear();
+		poolSize = 0;
+		overflowed = false;
+	}
+
+	// Depth test of the samples in covered against their 1/z values.
+	// centerZinv is 1/z at the pixel center, kept for unexpanded pixels.
+	// Writes the depth of the samples that pass and returns their mask.
+	int TestDepth( int x, int y, int covered, const float* zinv, float centerZinv )
+	{
+		int tile = tiles.TileAt(x, y);
+		if (tiles.Claim(tile))
+		{
+			tiles.Fill(tile, &depth[0], 0.0f);
+			tiles.Fill(tile, &color[0], glm::vec3(0.0f));
+			tiles.Fill(tile, &expanded[0], -1);
+		}
+
+		int i = y * width + x;
+		int block = expanded[i];
+		if (block < 0)
+		{
+			int passed = 0;
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				if (((covered >> s) & 1) && zinv[s] > depth[i])
+					passed |= 1 << s;
+			}
+			if (passed == 0)
+				return 0;
+			if (passed == fullMask)
+			{
+				depth[i] = centerZinv;
+				return passed;
+			}
+
+			block = Expand(i);
+			if (block < 0)
+			{
+				// Out of samples this frame: treat the pixel as covered
+				// if most of its samples are.
+				if (Popcount(passed) * 2 < sampleCount || centerZinv <= depth[i])
+					return 0;
+				depth[i] = centerZinv;
+				return fullMask;
+			}
+		}
+
+		float* samples = &poolDepth[block * sampleCount];
+		int passed = 0;
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			if (((covered >> s) & 1) && zinv[s] > samples[s])
+			{
+				samples[s] = zinv[s];
+				passed |= 1 << s;
+			}
+		}
+		return passed;
+	}
+
+	// Stores a shaded color in the samples returned by TestDepth().
+	void Write( int x, int y, int samples, const glm::vec3& c )
+	{
+		int i = y * width + x;
+		int block = expanded[i];
+		if (block < 0)
+		{
+			color[i] = c;
+			return;
+		}
+		glm::vec3* colors = &poolColor[block * sampleCount];
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			if ((samples >> s) & 1)
+				colors[s] = c;
+		}
+	}
+
+	// Averages each pixel's samples into the screen, RESOLVE_SPAN pixels
+	// of a row at a time. Pixels of tiles no triangle reached are black.
+	void Resolve( SDL2Aux* screen ) const
+	{
+		const int RESOLVE_SPAN = 64;
+		glm::vec3 span[RESOLVE_SPAN];
+		float weight = 1.0f / sampleCount;
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x0 = 0; x0 < width; x0 += RESOLVE_SPAN)
+			{
+				int count = std::min(RESOLVE_SPAN, width - x0);
+				for (int k = 0; k < count; ++k)
+				{
+					int i = y * width + x0 + k;
+					if (!tiles.Current(tiles.TileAt(x0 + k, y)))
+					{
+						span[k] = glm::vec3(0.0f);
+						continue;
+					}
+					int block = expanded[i];
+					if (block < 0)
+					{
+						span[k] = color[i];
+						continue;
+					}
+					glm::vec3 sum(0.0f);
+					for (int s = 0; s < sampleCount; ++s)
+						sum += poolColor[block * sampleCount + s];
+					span[k] = sum * weight;
+				}
+				screen->putSpan(x0, y, count, span);
+			}
+		}
+	}
+
+private:
+	int width;
+	int height;
+	int sampleCount;
+	int fullMask;
+	const int (*offsets)[2];
+
+	std::vector<float> depth;			// 1/z of unexpanded pixels, 0 = empty
+	std::vector<glm::vec3> color;		// Color of unexpanded pixels
+	std::vector<int> expanded;			// Pool block of each pixel, -1 if none
+	TileClear tiles;					// Clears the three above
+
+	// Per-sample storage of expanded pixels, sampleCount entries per block.
+	std::vector<float> poolDepth;
+	std::vector<glm::vec3> poolColor;
+	int poolCapacity;					// In blocks
+	int poolSize;
+	bool overflowed;
+
+	void Reserve( int blocks )
+	{
+		poolDepth.resize(blocks * sampleCount);
+		poolColor.resize(blocks * sampleCount);
+		poolCapacity = blocks;
+	}
+
+	// Moves pixel i to per-sample storage. Returns its block, or -1 if the
+	// pool is full.
+	int Expand( int i )
+	{
+		if (poolSize == poolCapacity)
+		{
+			overflowed = true;
+			return -1;
+		}
+		int block = poolSize++;
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			poolDepth[block * sampleCount + s] = depth[i];
+			poolColor[block * sampleCount + s] = color[i];
+		}
+		expanded[i] = block;
+		return block;
+	}
+
+	static int Popcount( int mask )
+	{
+		int n = 0;
+		for (; mask != 0; mask &= mask - 1)
+			++n;
+		return n;
+	}
+};
+
+#endif
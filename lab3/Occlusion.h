@@ -0,0 +1,329 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+// Occlusion culling with a software depth pre-pass. Every object gets a
+// simplified occluder mesh: the coplanar triangle pairs of its coarsest
+// exact level of detail merged into convex quads. Before drawing, the
+// occluders are rasterized into a low-resolution depth buffer and the
+// bounding box of each object is tested against it, four texels at a time.
+// Objects entirely behind the occluders, or outside the view, are not
+// submitted at all.
+//
+// Both sides are conservative: an occluder only writes the texels it
+// covers completely, with the farthest depth it has inside them, and a box
+// is tested with its nearest depth over every texel its projection touches.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+#include "Simd.h"
+
+// Relative, absorbs rounding differences between the occluder planes and
+// the box corners.
+const float OCCLUSION_DEPTH_BIAS = 1e-4f;
+
+class OcclusionCuller
+{
+public:
+	// The depth buffer has one texel per scale x scale screen pixels.
+	OcclusionCuller( int screenWidth, int screenHeight, int scale = 4 )
+		: scale(scale), width((screenWidth + scale - 1) / scale), height((screenHeight + scale - 1) / scale),
+		stride(SimdPadded(width)), depth(stride * height), culled(0)
+	{
+	}
+
+	// Builds the occluder proxies of the objects of mesh. Offline; Cull()
+	// does not allocate.
+	void Build( const IndexedMesh& mesh )
+	{
+		objects = mesh.objects;
+		visible.assign(objects.size(), 1);
+		polygonStart.assign(1, 0);
+		polygonVertices.clear();
+		polygonNormals.clear();
+
+		for (size_t o = 0; o < objects.size(); ++o)
+		{
+			// Coarser levels may bulge out of the surface, so would not be
+			// conservative.
+			const MeshLod& lod = mesh.Lod(int(o), mesh.ExactLod(int(o)));
+			std::vector<bool> merged(lod.triangleCount, false);
+			for (int i = 0; i < lod.triangleCount; ++i)
+			{
+				if (merged[i])
+					continue;
+				int t = lod.firstTriangle + i;
+				glm::vec3 quad[4];
+				int count = 3;
+				for (int j = i + 1; j < lod.triangleCount && count == 3; ++j)
+				{
+					if (!merged[j] && MergeQuad(mesh, t, lod.firstTriangle + j, quad))
+					{
+						merged[j] = true;
+						count = 4;
+					}
+				}
+				if (count == 3)
+				{
+					for (int k = 0; k < 3; ++k)
+						quad[k] = mesh.positions[mesh.indices[3 * t + k]];
+				}
+				polygonVertices.insert(polygonVertices.end(), quad, quad + count);
+				polygonStart.push_back(int(polygonVertices.size()));
+				polygonNormals.push_back(mesh.normals[t]);
+			}
+		}
+	}
+
+	// Renders the occluders as seen by camera, then tests every object.
+	void Cull( const Camera& camera )
+	{
+		std::fill(depth.begin(), depth.end(), 0.0f);
+		for (size_t p = 0; p < polygonNormals.size(); ++p)
+		{
+			RasterizeOccluder(camera, &polygonVertices[polygonStart[p]],
+				polygonStart[p + 1] - polygonStart[p], polygonNormals[p]);
+		}
+
+		culled = 0;
+		for (size_t o = 0; o < objects.size(); ++o)
+		{
+			visible[o] = BoxVisible(camera, objects[o]);
+			culled += !visible[o];
+		}
+	}
+
+	// One flag per mesh object, for DrawIndexedMesh().
+	const uint8_t* Visible() const { return visible.empty() ? NULL : &visible[0]; }
+	int CulledCount() const { return culled; }
+	int OccluderCount() const { return int(polygonNormals.size()); }
+
+private:
+	static const int MAX_POLYGON = 8;
+
+	int scale;
+	int width;
+	int height;
+	int stride;
+	std::vector<float> depth;			// 1/z, 0 = no occluder
+
+	std::vector<MeshObject> objects;
+	std::vector<uint8_t> visible;
+	int culled;
+
+	// Occluder polygon p is polygonVertices[polygonStart[p], polygonStart[p + 1]).
+	std::vector<int> polygonStart;
+	std::vector<glm::vec3> polygonVertices;
+	std::vector<glm::vec3> polygonNormals;
+
+	// Merges triangles t and u into the convex quad out if they are
+	// coplanar and share an edge.
+	static bool MergeQuad( const IndexedMesh& mesh, int t, int u, glm::vec3* out )
+	{
+		if (glm::dot(mesh.normals[t], mesh.normals[u]) < 0.9999f)
+			return false;
+
+		glm::vec3 a[3], b[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			a[k] = mesh.positions[mesh.indices[3 * t + k]];
+			b[k] = mesh.positions[mesh.indices[3 * u + k]];
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			// Edge a[k + 1] -> a[k + 2] of t, run the other way in u.
+			const glm::vec3& p = a[(k + 1) % 3];
+			const glm::vec3& q = a[(k + 2) % 3];
+			for (int m = 0; m < 3; ++m)
+			{
+				if (b[m] != q || b[(m + 1) % 3] != p)
+					continue;
+				const glm::vec3& r = b[(m + 2) % 3];
+
+				// Convex if p and q lie on opposite sides of the diagonal
+				// from a[k] to r.
+				glm::vec3 diagonal = r - a[k];
+				float sp = glm::dot(glm::cross(diagonal, p - a[k]), mesh.normals[t]);
+				float sq = glm::dot(glm::cross(diagonal, q - a[k]), mesh.normals[t]);
+				if (sp * sq >= 0)
+					return false;
+
+				out[0] = a[k];
+				out[1] = p;
+				out[2] = r;
+				out[3] = q;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Writes the farthest 1/z of a convex planar polygon into the texels
+	// it covers completely.
+	void RasterizeOccluder( const Camera& camera, const glm::vec3* polygon, int count, const glm::vec3& normal )
+	{
+		// View space, clipped against the near plane.
+		glm::vec3 view[MAX_POLYGON / 2];
+		glm::vec3 clipped[MAX_POLYGON];
+		int n = 0;
+		for (int i = 0; i < count; ++i)
+			view[i] = camera.ToView(polygon[i]);
+		for (int i = 0; i < count; ++i)
+		{
+			const glm::vec3& a = view[i];
+			const glm::vec3& b = view[(i + 1) % count];
+			if (a.z >= NEAR_PLANE)
+				clipped[n++] = a;
+			if ((a.z >= NEAR_PLANE) != (b.z >= NEAR_PLANE))
+				clipped[n++] = a + (b - a) * ((NEAR_PLANE - a.z) / (b.z - a.z));
+		}
+		if (n < 3)
+			return;
+
+		// 1/z is linear in screen space over the plane n.p = d:
+		// 1/z = (n.x x/z + n.y y/z + n.z) / d.
+		glm::vec3 viewNormal = normal * camera.R;
+		float d = glm::dot(viewNormal, clipped[0]);
+		if (std::fabs(d) < 1e-6f)
+			return;
+		float f = camera.focalLength;
+		float planeA = viewNormal.x * scale / (f * d);
+		float planeB = viewNormal.y * scale / (f * d);
+		float planeC = (viewNormal.z - (viewNormal.x * camera.width + viewNormal.y * camera.height) * 0.5f / f) / d;
+		// Farthest point of a texel relative to its center.
+		planeC -= 0.5f * (std::fabs(planeA) + std::fabs(planeB));
+
+		// Texel coordinates, and edge functions positive inside.
+		glm::vec2 screen[MAX_POLYGON];
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+		float area = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			screen[i].x = (f * clipped[i].x / clipped[i].z + camera.width * 0.5f) / scale;
+			screen[i].y = (f * clipped[i].y / clipped[i].z + camera.height * 0.5f) / scale;
+			minX = std::min(minX, screen[i].x);
+			maxX = std::max(maxX, screen[i].x);
+			minY = std::min(minY, screen[i].y);
+			maxY = std::max(maxY, screen[i].y);
+		}
+		for (int i = 0; i < n; ++i)
+		{
+			const glm::vec2& p = screen[i];
+			const glm::vec2& q = screen[(i + 1) % n];
+			area += p.x * q.y - q.x * p.y;
+		}
+		if (std::fabs(area) < 1e-6f)
+			return;
+
+		Float4 edgeA[MAX_POLYGON], edgeB[MAX_POLYGON], edgeC[MAX_POLYGON];
+		for (int i = 0; i < n; ++i)
+		{
+			const glm::vec2& p = screen[i];
+			const glm::vec2& q = screen[(i + 1) % n];
+			float a = p.y - q.y;
+			float b = q.x - p.x;
+			float c = p.x * q.y - p.y * q.x;
+			if (area < 0)
+			{
+				a = -a;
+				b = -b;
+				c = -c;
+			}
+			// The whole texel is inside where the center is this far in.
+			c -= 0.5f * (std::fabs(a) + std::fabs(b));
+			edgeA[i] = Float4::Set1(a);
+			edgeB[i] = Float4::Set1(b);
+			edgeC[i] = Float4::Set1(c);
+		}
+
+		// Texels with centers inside the bounds, in aligned groups of four.
+		int x0 = std::max(0, int(std::ceil(minX - 0.5f)));
+		int x1 = std::min(width - 1, int(std::floor(maxX - 0.5f)));
+		int y0 = std::max(0, int(std::ceil(minY - 0.5f)));
+		int y1 = std::min(height - 1, int(std::floor(maxY - 0.5f)));
+		Float4 first = Float4::Set1(float(x0));
+		Float4 last = Float4::Set1(x1 + 1.0f);
+		Float4 a = Float4::Set1(planeA);
+		Float4 b = Float4::Set1(planeB);
+		Float4 c = Float4::Set1(planeC);
+		for (int y = y0; y <= y1; ++y)
+		{
+			Float4 cy = Float4::Set1(y + 0.5f);
+			for (int x = x0 & ~3; x <= x1; x += 4)
+			{
+				Float4 cx = Float4::Set(x + 0.5f, x + 1.5f, x + 2.5f, x + 3.5f);
+				Float4 inside = (cx > first) & (last > cx);
+				for (int i = 0; i < n; ++i)
+					inside = inside & (edgeA[i] * cx + edgeB[i] * cy + edgeC[i] >= Float4::Set1(0.0f));
+				if (MoveMask(inside) == 0)
+					continue;
+
+				float* texels = &depth[y * stride + x];
+				Float4 old = Float4::Load(texels);
+				Select(inside, Max(old, a * cx + b * cy + c), old).Store(texels);
+			}
+		}
+	}
+
+	// True unless the box is outside the view or behind the occluders
+	// everywhere it projects to.
+	bool BoxVisible( const Camera& camera, const MeshObject& object ) const
+	{
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+		float nearest = 0;
+		int behind = 0;
+		for (int k = 0; k < 8; ++k)
+		{
+			glm::vec3 corner((k & 1) ? object.boundsMax.x : object.boundsMin.x,
+				(k & 2) ? object.boundsMax.y : object.boundsMin.y,
+				(k & 4) ? object.boundsMax.z : object.boundsMin.z);
+			glm::vec3 view = camera.ToView(corner);
+			if (view.z < NEAR_PLANE)
+			{
+				++behind;
+				continue;
+			}
+			float zinv = 1.0f / view.z;
+			float x = (camera.focalLength * view.x * zinv + camera.width * 0.5f) / scale;
+			float y = (camera.focalLength * view.y * zinv + camera.height * 0.5f) / scale;
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			nearest = std::max(nearest, zinv);
+		}
+		if (behind == 8)
+			return false;
+		if (behind > 0)
+			return true;
+
+		int x0 = std::max(0, int(std::floor(minX)));
+		int x1 = std::min(width - 1, int(std::floor(maxX)));
+		int y0 = std::max(0, int(std::floor(minY)));
+		int y1 = std::min(height - 1, int(std::floor(maxY)));
+		if (x0 > x1 || y0 > y1)
+			return false;
+
+		Float4 first = Float4::Set1(float(x0));
+		Float4 last = Float4::Set1(float(x1));
+		Float4 boxDepth = Float4::Set1(nearest * (1.0f + OCCLUSION_DEPTH_BIAS));
+		for (int y = y0; y <= y1; ++y)
+		{
+			const float* row = &depth[y * stride];
+			for (int x = x0 & ~3; x <= x1; x += 4)
+			{
+				Float4 lane = Float4::Set(float(x), x + 1.0f, x + 2.0f, x + 3.0f);
+				Float4 inside = (lane >= first) & (last >= lane);
+				if (MoveMask(inside & (boxDepth >= Float4::Load(row + x))) != 0)
+					return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,743 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// Templated raster pipeline. Vertex and pixel shaders are functors passed
+// as template parameters together with the varyings they exchange, so each
+// shader combination gets its own raster loop with both shaders inlined and
+// only the varyings it actually uses interpolated.
+//
+// Triangles are rasterized with edge functions in 2x2 pixel quads, one
+// pixel per Float4 lane, so coverage, the depth test and interpolation run
+// four pixels at a time and pixel shaders can too. Vertices are snapped to
+// 28.4 fixed point and sampled at pixel centers with a top-left fill rule,
+// so triangles sharing an edge never both cover a pixel on it.
+//
+// A vertex shader provides:
+//	typedef Varyings<N> Out;
+//	void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index,
+//		ClipVertex<Out>& out ) const;
+// and outputs the view-space position of vertex index, which the pipeline clips against
+// the near plane before projecting.
+//
+// A pixel shader provides:
+//	void BeginTriangle( const IndexedMesh& mesh, int triangle );
+//	void operator()( const Quad<Out>& quad );
+// and is only invoked for quads with at least one fragment that passed the
+// depth test; the others are masked off in quad.mask.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include "IndexedMesh.h"
+#include "Msaa.h"
+#include "Simd.h"
+#include "TileClear.h"
+
+// Fixed-size set of float varyings interpolated across a triangle.
+template<int N>
+struct Varyings
+{
+	enum { COUNT = N };
+	float v[N];
+
+	glm::vec3 Vec3( int i ) const { return glm::vec3(v[i], v[i + 1], v[i + 2]); }
+	void SetVec3( int i, const glm::vec3& a ) { v[i] = a.x; v[i + 1] = a.y; v[i + 2] = a.z; }
+};
+
+// Nothing to interpolate; the raster loop compiles down to 1/z only.
+template<>
+struct Varyings<0>
+{
+	enum { COUNT = 0 };
+	float v[1];
+};
+
+// Output of the vertex stage: view-space position and varyings.
+template<typename VaryingsT>
+struct ClipVertex
+{
+	glm::vec3 view;
+	VaryingsT varyings;
+};
+
+// Sub-pixel precision of projected vertices.
+const int SUBPIXEL_BITS = 4;
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+
+// Projected vertex: 28.4 fixed-point pixel coordinates, 1/z and varyings.
+// Pixel (x, y) covers [x, x + 1) and is sampled at its center.
+template<typename VaryingsT>
+struct ShadedVertex
+{
+	int x;
+	int y;
+	float zinv;
+	VaryingsT varyings;
+};
+
+// 2x2 block of fragments handed to the pixel shader. Lane k is the pixel
+// (X(k), Y(k)): lanes 0 and 1 are the top row, 2 and 3 the bottom one.
+template<typename VaryingsT>
+struct Quad
+{
+	int x;			// Top-left pixel
+	int y;
+	int mask;		// Bit k set if lane k is covered and passed the depth test
+	int samples[4];	// MSAA targets: samples of lane k that passed
+	Float4 zinv;
+	Float4 v[VaryingsT::COUNT > 0 ? VaryingsT::COUNT : 1];
+
+	int X( int k ) const { return x + (k & 1); }
+	int Y( int k ) const { return y + (k >> 1); }
+	bool Active( int k ) const { return (mask >> k) & 1; }
+	Vec3x4 Vec3( int i ) const { return Vec3x4(v[i], v[i + 1], v[i + 2]); }
+};
+
+// Depth buffer the pipeline tests against, storing 1/z (0 = empty). If
+// msaa is set, coverage and depth are per sample in it instead and depth
+// is unused. If tiles is set, depth is cleared lazily per tile by it.
+struct RenderTarget
+{
+	int width;
+	int height;
+	float* depth;
+	MsaaBuffer* msaa;
+	TileClear* tiles;
+};
+
+// Geometry closer than this (in view space) is clipped away.
+const float NEAR_PLANE = 1e-3f;
+
+// Pinhole camera. The columns of R are the camera's right, down and
+// forward axes in world space.
+struct Camera
+{
+	glm::vec3 position;
+	glm::mat3 R;
+	float focalLength;
+	int width;
+	int height;
+
+	glm::vec3 ToView( const glm::vec3& world ) const
+	{
+		return (world - position) * R;
+	}
+
+	// World-space direction of the ray through screen point (x, y), in
+	// pixels, scaled to unit view depth. Pixel centers are at + 0.5.
+	glm::vec3 RayDirection( float x, float y ) const
+	{
+		return R * glm::vec3((x - width / 2) / focalLength, (y - height / 2) / focalLength, 1.0f);
+	}
+
+	template<typename VaryingsT>
+	void Project( const ClipVertex<VaryingsT>& in, ShadedVertex<VaryingsT>& out ) const
+	{
+		const glm::vec3& pos = in.view;
+		out.zinv = 1.0f / pos.z;
+		out.x = int(std::floor((focalLength * pos.x / pos.z + width / 2) * SUBPIXEL_ONE + 0.5f));
+		out.y = int(std::floor((focalLength * pos.y / pos.z + height / 2) * SUBPIXEL_ONE + 0.5f));
+		out.varyings = in.varyings;
+	}
+};
+
+// Edge function w(x, y) = a x + b y + c of the directed edge p-q in
+// fixed-point coordinates: zero on the edge and positive on the side of a
+// counter-clockwise triangle's interior. Exact in 64-bit integers, since
+// clipped vertices may project far off screen.
+struct EdgeFunction
+{
+	long long a;
+	long long b;
+	long long c;
+	// Smallest w counted as covered: 0 on top and left edges, 1 on the
+	// others, so a sample exactly on a shared edge belongs to one triangle.
+	long long threshold;
+
+	EdgeFunction() {}
+	EdgeFunction( int px, int py, int qx, int qy, int sign )
+	{
+		a = sign * -(long long)(qy - py);
+		b = sign * (long long)(qx - px);
+		c = -(a * px + b * py);
+		// With y down, the interior lies right of a left edge (a > 0) and
+		// below a horizontal top edge (a == 0, b > 0).
+		bool topLeft = a > 0 || (a == 0 && b > 0);
+		threshold = topLeft ? 0 : 1;
+	}
+
+	// Value at the center of pixel (x, y).
+	long long AtPixel( int x, int y ) const
+	{
+		return a * (x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2) + b * (y * SUBPIXEL_ONE + SUBPIXEL_ONE / 2) + c;
+	}
+};
+
+// First and last pixel whose center lies in the fixed-point range [lo, hi].
+inline int FirstPixelCenter( int lo )
+{
+	return -((SUBPIXEL_ONE / 2 - lo) >> SUBPIXEL_BITS);
+}
+
+inline int LastPixelCenter( int hi )
+{
+	return (hi - SUBPIXEL_ONE / 2) >> SUBPIXEL_BITS;
+}
+
+// Per-triangle constants of the raster loops: pixel bounds, edge functions
+// and the planes of 1/z and varying/z.
+template<typename VaryingsT>
+struct TriangleSetup
+{
+	enum { N = VaryingsT::COUNT > 0 ? VaryingsT::COUNT : 1 };
+
+	int minX, maxX, minY, maxY;	// Clipped to the target
+	// Edge i is opposite vertex i, so w_i / area is vertex i's barycentric
+	// weight.
+	EdgeFunction edges[3];
+	long long laneStep[3][4];	// Offsets of the quad's samples from its first
+	Float4 laneOffset[3];
+
+	// Edge values are affine, so if they fit 32 bits at the corners of the
+	// bounds they do everywhere inside and coverage is tested on Int4; only
+	// triangles reaching far off screen need 64 bits.
+	bool fits32;
+	Int4 laneOffset32[3];
+	Int4 threshold32[3];
+
+	// 1/z and varying/z are affine in screen space: q = q0 + l1 (q1 - q0) +
+	// l2 (q2 - q0) with barycentrics l1, l2.
+	Float4 invArea;
+	Float4 zinv0, zinvD1, zinvD2;
+	float zinvDx, zinvDy;		// Per fixed-point unit
+	Float4 overZ0[N], overZD1[N], overZD2[N];
+
+	// Returns false if the triangle covers no pixel of the target. Pixels
+	// within margin (fixed point) of the triangle's bounds are visited.
+	bool Init( const ShadedVertex<VaryingsT>* vertices, const RenderTarget& target, int margin )
+	{
+		const ShadedVertex<VaryingsT>& v0 = vertices[0];
+		const ShadedVertex<VaryingsT>& v1 = vertices[1];
+		const ShadedVertex<VaryingsT>& v2 = vertices[2];
+
+		minX = std::max(FirstPixelCenter(std::min(std::min(v0.x, v1.x), v2.x) - margin), 0);
+		maxX = std::min(LastPixelCenter(std::max(std::max(v0.x, v1.x), v2.x) + margin), target.width - 1);
+		minY = std::max(FirstPixelCenter(std::min(std::min(v0.y, v1.y), v2.y) - margin), 0);
+		maxY = std::min(LastPixelCenter(std::max(std::max(v0.y, v1.y), v2.y) + margin), target.height - 1);
+		if (minX > maxX || minY > maxY)
+			return false;
+
+		long long area = (long long)(v1.x - v0.x) * (v2.y - v0.y) - (long long)(v1.y - v0.y) * (v2.x - v0.x);
+		if (area == 0)
+			return false;
+		int sign = area > 0 ? 1 : -1;
+
+		edges[0] = EdgeFunction(v1.x, v1.y, v2.x, v2.y, sign);
+		edges[1] = EdgeFunction(v2.x, v2.y, v0.x, v0.y, sign);
+		edges[2] = EdgeFunction(v0.x, v0.y, v1.x, v1.y, sign);
+
+		fits32 = true;
+		for (int e = 0; e < 3; ++e)
+		{
+			long long dx = edges[e].a * SUBPIXEL_ONE;
+			long long dy = edges[e].b * SUBPIXEL_ONE;
+			laneStep[e][0] = 0;
+			laneStep[e][1] = dx;
+			laneStep[e][2] = dy;
+			laneStep[e][3] = dx + dy;
+			laneOffset[e] = Float4::Set(0.0f, float(dx), float(dy), float(dx + dy));
+
+			const long long limit = 1LL << 30;
+			int cornersX[2] = { (minX & ~1) - 1, maxX + 1 };
+			int cornersY[2] = { (minY & ~1) - 1, maxY + 1 };
+			for (int i = 0; i < 4; ++i)
+			{
+				long long w = edges[e].AtPixel(cornersX[i & 1], cornersY[i >> 1]);
+				fits32 = fits32 && w > -limit && w < limit;
+			}
+			if (fits32)
+			{
+				laneOffset32[e] = Int4::Set(0, int(dx), int(dy), int(dx + dy));
+				threshold32[e] = Int4::Set1(int(edges[e].threshold) - 1);
+			}
+		}
+
+		float absArea = float(area * sign);
+		invArea = Float4::Set1(1.0f / absArea);
+		zinv0 = Float4::Set1(v0.zinv);
+		zinvD1 = Float4::Set1(v1.zinv - v0.zinv);
+		zinvD2 = Float4::Set1(v2.zinv - v0.zinv);
+		zinvDx = (edges[1].a * (v1.zinv - v0.zinv) + edges[2].a * (v2.zinv - v0.zinv)) / absArea;
+		zinvDy = (edges[1].b * (v1.zinv - v0.zinv) + edges[2].b * (v2.zinv - v0.zinv)) / absArea;
+		for (int v = 0; v < VaryingsT::COUNT; ++v)
+		{
+			float a = v0.varyings.v[v] * v0.zinv;
+			overZ0[v] = Float4::Set1(a);
+			overZD1[v] = Float4::Set1(v1.varyings.v[v] * v1.zinv - a);
+			overZD2[v] = Float4::Set1(v2.varyings.v[v] * v2.zinv - a);
+		}
+		return true;
+	}
+
+	// Lanes of the quad whose sample at (dx, dy) from the pixel centers
+	// (fixed point) is covered, given the edge values w at its first center.
+	int Coverage( const long long* w, int dx, int dy ) const
+	{
+		if (fits32)
+		{
+			Float4 covered = Float4::Mask(0xf);
+			for (int e = 0; e < 3; ++e)
+			{
+				int we = int(w[e] + edges[e].a * dx + edges[e].b * dy);
+				covered = covered & (Int4::Set1(we) + laneOffset32[e] > threshold32[e]);
+			}
+			return MoveMask(covered);
+		}
+
+		int mask = 0xf;
+		for (int e = 0; e < 3; ++e)
+		{
+			long long we = w[e] + edges[e].a * dx + edges[e].b * dy;
+			for (int k = 0; k < 4; ++k)
+			{
+				if (we + laneStep[e][k] < edges[e].threshold)
+					mask &= ~(1 << k);
+			}
+		}
+		return mask;
+	}
+
+	// Barycentrics l1, l2 of the quad's pixel centers.
+	void Barycentrics( const long long* w, Float4& l1, Float4& l2 ) const
+	{
+		l1 = (Float4::Set1(float(w[1])) + laneOffset[1]) * invArea;
+		l2 = (Float4::Set1(float(w[2])) + laneOffset[2]) * invArea;
+	}
+
+	Float4 Zinv( Float4 l1, Float4 l2 ) const
+	{
+		return zinv0 + l1 * zinvD1 + l2 * zinvD2;
+	}
+
+	// Fills in the perspective-correct varyings of the quad.
+	void Interpolate( Float4 l1, Float4 l2, Quad<VaryingsT>& quad ) const
+	{
+		Float4 z = Float4::Set1(1.0f) / quad.zinv;
+		for (int v = 0; v < VaryingsT::COUNT; ++v)
+			quad.v[v] = (overZ0[v] + l1 * overZD1[v] + l2 * overZD2[v]) * z;
+	}
+};
+
+// Lanes of a quad at (x, y) that lie inside the setup's bounds.
+template<typename VaryingsT>
+int QuadInside( const TriangleSetup<VaryingsT>& setup, int x, int y )
+{
+	return (y + 1 <= setup.maxY ? 0xf : 0x3) & (x >= setup.minX ? 0xf : 0xa) &
+		(x + 1 <= setup.maxX ? 0xf : 0x5) & (y >= setup.minY ? 0xf : 0xc);
+}
+
+// Single-sample raster loop: coverage and depth at pixel centers.
+template<typename PixelShaderT, typename VaryingsT>
+void RasterizeSetup( const TriangleSetup<VaryingsT>& setup, PixelShaderT& ps, RenderTarget& target )
+{
+	Quad<VaryingsT> quad;
+	for (int k = 0; k < 4; ++k)
+		quad.samples[k] = 1;
+	for (int y = setup.minY & ~1; y <= setup.maxY; y += 2)
+	{
+		long long w[3];
+		for (int e = 0; e < 3; ++e)
+			w[e] = setup.edges[e].AtPixel(setup.minX & ~1, y) - 2 * setup.laneStep[e][1];
+		for (int x = setup.minX & ~1; x <= setup.maxX; x += 2)
+		{
+			for (int e = 0; e < 3; ++e)
+				w[e] += 2 * setup.laneStep[e][1];
+			int inside = QuadInside(setup, x, y);
+			int mask = inside & setup.Coverage(w, 0, 0);
+			if (mask == 0)
+				continue;
+
+			Float4 l1, l2;
+			setup.Barycentrics(w, l1, l2);
+			Float4 zinv = setup.Zinv(l1, l2);
+
+			// Depth test and masked depth write. Quads inside the target
+			// load and store both rows at once.
+			if (target.tiles != NULL)
+				target.tiles->Touch(x, y, target.depth);
+			float* row0 = target.depth + y * target.width + x;
+			float* row1 = row0 + target.width;
+			Float4 depth;
+			if (inside == 0xf)
+			{
+				depth = Float4::LoadPairs(row0, row1);
+			}
+			else
+			{
+				float lanes[4] = { 0, 0, 0, 0 };
+				for (int k = 0; k < 4; ++k)
+				{
+					if ((inside >> k) & 1)
+						lanes[k] = (k < 2 ? row0 : row1)[k & 1];
+				}
+				depth = Float4::Load(lanes);
+			}
+			mask &= MoveMask(zinv > depth);
+			if (mask == 0)
+				continue;
+
+			depth = Select(Float4::Mask(mask), zinv, depth);
+			if (inside == 0xf)
+			{
+				depth.StorePairs(row0, row1);
+			}
+			else
+			{
+				for (int k = 0; k < 4; ++k)
+				{
+					if ((mask >> k) & 1)
+						(k < 2 ? row0 : row1)[k & 1] = depth[k];
+				}
+			}
+
+			quad.x = x;
+			quad.y = y;
+			quad.mask = mask;
+			quad.zinv = zinv;
+			setup.Interpolate(l1, l2, quad);
+			ps(quad);
+		}
+	}
+}
+
+// MSAA raster loop: coverage and depth per sample, varyings and the pixel
+// shader once per pixel at its center.
+template<typename PixelShaderT, typename VaryingsT>
+void RasterizeSetupMsaa( const TriangleSetup<VaryingsT>& setup, PixelShaderT& ps, MsaaBuffer& msaa )
+{
+	const int S = msaa.SampleCount();
+	float sampleDz[MAX_MSAA_SAMPLES];
+	Int4 sampleOffset32[3][MAX_MSAA_SAMPLES];
+	for (int s = 0; s < S; ++s)
+	{
+		sampleDz[s] = setup.zinvDx * msaa.SampleX(s) + setup.zinvDy * msaa.SampleY(s);
+		for (int e = 0; e < 3 && setup.fits32; ++e)
+		{
+			int offset = int(setup.edges[e].a * msaa.SampleX(s) + setup.edges[e].b * msaa.SampleY(s));
+			sampleOffset32[e][s] = setup.laneOffset32[e] + Int4::Set1(offset);
+		}
+	}
+
+	Quad<VaryingsT> quad;
+	for (int y = setup.minY & ~1; y <= setup.maxY; y += 2)
+	{
+		long long w[3];
+		for (int e = 0; e < 3; ++e)
+			w[e] = setup.edges[e].AtPixel(setup.minX & ~1, y) - 2 * setup.laneStep[e][1];
+		for (int x = setup.minX & ~1; x <= setup.maxX; x += 2)
+		{
+			for (int e = 0; e < 3; ++e)
+				w[e] += 2 * setup.laneStep[e][1];
+			int inside = QuadInside(setup, x, y);
+
+			int covered[4] = { 0, 0, 0, 0 };
+			int any = 0;
+			if (setup.fits32)
+			{
+				Int4 base[3];
+				for (int e = 0; e < 3; ++e)
+					base[e] = Int4::Set1(int(w[e]));
+				for (int s = 0; s < S; ++s)
+				{
+					int lanes = inside & MoveMask(
+						(base[0] + sampleOffset32[0][s] > setup.threshold32[0]) &
+						(base[1] + sampleOffset32[1][s] > setup.threshold32[1]) &
+						(base[2] + sampleOffset32[2][s] > setup.threshold32[2]));
+					any |= lanes;
+					for (int k = 0; k < 4; ++k)
+						covered[k] |= ((lanes >> k) & 1) << s;
+				}
+			}
+			else
+			{
+				for (int s = 0; s < S; ++s)
+				{
+					int lanes = inside & setup.Coverage(w, msaa.SampleX(s), msaa.SampleY(s));
+					any |= lanes;
+					for (int k = 0; k < 4; ++k)
+						covered[k] |= ((lanes >> k) & 1) << s;
+				}
+			}
+			if (any == 0)
+				continue;
+
+			Float4 l1, l2;
+			setup.Barycentrics(w, l1, l2);
+			quad.zinv = setup.Zinv(l1, l2);
+			float centerZinv[4];
+			quad.zinv.Store(centerZinv);
+
+			int mask = 0;
+			for (int k = 0; k < 4; ++k)
+			{
+				quad.samples[k] = 0;
+				if (covered[k] == 0)
+					continue;
+				float zinv[MAX_MSAA_SAMPLES];
+				for (int s = 0; s < S; ++s)
+					zinv[s] = centerZinv[k] + sampleDz[s];
+				quad.samples[k] = msaa.TestDepth(x + (k & 1), y + (k >> 1), covered[k], zinv, centerZinv[k]);
+				if (quad.samples[k] != 0)
+					mask |= 1 << k;
+			}
+			if (mask == 0)
+				continue;
+
+			quad.x = x;
+			quad.y = y;
+			quad.mask = mask;
+			setup.Interpolate(l1, l2, quad);
+			ps(quad);
+		}
+	}
+}
+
+// Scan converts a triangle of shaded vertices in 2x2 quads and runs the
+// pixel shader on every quad with a fragment that passes the depth test.
+// Either winding is drawn. Coverage is decided exactly in integers, so the
+// result does not depend on the order triangles or quads are visited in.
+template<typename PixelShaderT, typename VaryingsT>
+void RasterizeTriangle( const ShadedVertex<VaryingsT>* vertices, PixelShaderT& ps, RenderTarget& target )
+{
+	TriangleSetup<VaryingsT> setup;
+	if (target.msaa != NULL)
+	{
+		// Samples reach up to half a pixel from the centers.
+		if (setup.Init(vertices, target, SUBPIXEL_ONE / 2))
+			RasterizeSetupMsaa(setup, ps, *target.msaa);
+	}
+	else if (setup.Init(vertices, target, 0))
+	{
+		RasterizeSetup(setup, ps, target);
+	}
+}
+
+// Point on the segment a-b where it crosses the near plane.
+template<typename VaryingsT>
+ClipVertex<VaryingsT> IntersectNear( const ClipVertex<VaryingsT>& a, const ClipVertex<VaryingsT>& b )
+{
+	float t = (NEAR_PLANE - a.view.z) / (b.view.z - a.view.z);
+	ClipVertex<VaryingsT> r;
+	r.view = a.view + t * (b.view - a.view);
+	for (int v = 0; v < VaryingsT::COUNT; ++v)
+		r.varyings.v[v] = a.varyings.v[v] + t * (b.varyings.v[v] - a.varyings.v[v]);
+	return r;
+}
+
+// Clips a triangle against the near plane (Sutherland-Hodgman). Returns
+// the number of polygon vertices written to out: 0, 3 or 4.
+template<typename VaryingsT>
+int ClipNear( const ClipVertex<VaryingsT>* in, ClipVertex<VaryingsT>* out )
+{
+	int count = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const ClipVertex<VaryingsT>& a = in[i];
+		const ClipVertex<VaryingsT>& b = in[(i + 1) % 3];
+		bool aInside = a.view.z >= NEAR_PLANE;
+		bool bInside = b.view.z >= NEAR_PLANE;
+		if (aInside)
+			out[count++] = a;
+		if (aInside != bInside)
+			out[count++] = IntersectNear(a, b);
+	}
+	return count;
+}
+
+// Clips, projects and rasterizes one triangle from the vertex stage.
+template<typename PixelShaderT, typename VaryingsT>
+void DrawClippedTriangle( const ClipVertex<VaryingsT>* vertices, const Camera& camera,
+	PixelShaderT& ps, RenderTarget& target )
+{
+	ShadedVertex<VaryingsT> projected[4];
+	int count;
+	if (vertices[0].view.z >= NEAR_PLANE && vertices[1].view.z >= NEAR_PLANE &&
+		vertices[2].view.z >= NEAR_PLANE)
+	{
+		for (int k = 0; k < 3; ++k)
+			camera.Project(vertices[k], projected[k]);
+		count = 3;
+	}
+	else
+	{
+		ClipVertex<VaryingsT> clipped[4];
+		count = ClipNear(vertices, clipped);
+		for (int k = 0; k < count; ++k)
+			camera.Project(clipped[k], projected[k]);
+	}
+
+	if (count >= 3)
+		RasterizeTriangle(projected, ps, target);
+	if (count == 4)
+	{
+		ShadedVertex<VaryingsT> second[3] = { projected[0], projected[2], projected[3] };
+		RasterizeTriangle(second, ps, target);
+	}
+}
+
+// Counters filled in by DrawIndexedMesh().
+struct DrawStats
+{
+	int objects;				// Objects drawn
+	int meshlets;				// Meshlets tested
+	int offscreenMeshlets;		// Culled by their bounding sphere
+	int backfacingMeshlets;		// Culled by their normal cone
+	int vertices;				// Vertices shaded
+	int triangles;				// Triangles sent to clipping and rasterization
+
+	void Reset() { *this = DrawStats(); }
+};
+
+// What DrawIndexedMesh() draws of a mesh. The defaults draw every object at
+// full detail.
+struct DrawSelection
+{
+	const uint8_t* visible;		// One flag per object, 0 = skip
+	const int* lodLevels;		// One level of detail per object
+	bool cullBackfaces;			// Skip meshlets facing away from the camera
+	DrawStats* stats;			// Counters to add to
+};
+
+// False if the meshlet's bounding sphere is outside the view, or if every
+// point of it sees every normal in its cone from behind. The triangles
+// face the side their normal points to.
+inline bool MeshletVisible( const Meshlet& meshlet, const Camera& camera, bool cullBackfaces, DrawStats* stats )
+{
+	glm::vec3 center = camera.ToView(meshlet.center);
+	float r = meshlet.radius;
+	float halfWidth = 0.5f * camera.width;
+	float halfHeight = 0.5f * camera.height;
+	float f = camera.focalLength;
+	if (center.z < NEAR_PLANE - r ||
+		f * center.x - halfWidth * center.z > r * std::sqrt(f * f + halfWidth * halfWidth) ||
+		-f * center.x - halfWidth * center.z > r * std::sqrt(f * f + halfWidth * halfWidth) ||
+		f * center.y - halfHeight * center.z > r * std::sqrt(f * f + halfHeight * halfHeight) ||
+		-f * center.y - halfHeight * center.z > r * std::sqrt(f * f + halfHeight * halfHeight))
+	{
+		if (stats != NULL)
+			++stats->offscreenMeshlets;
+		return false;
+	}
+
+	// Culled if d cos(angle to the axis + cone half angle) >= r, with d the
+	// distance from the camera to the center.
+	if (cullBackfaces && meshlet.coneCos > 0)
+	{
+		glm::vec3 v = meshlet.center - camera.position;
+		float d = glm::length(v);
+		float cosAngle = d > 0 ? glm::dot(v, meshlet.coneAxis) / d : -1.0f;
+		float sinAngle = std::sqrt(std::max(0.0f, 1 - cosAngle * cosAngle));
+		if (cosAngle > 0 && d * (cosAngle * meshlet.coneCos - sinAngle * meshlet.coneSin) >= r)
+		{
+			if (stats != NULL)
+				++stats->backfacingMeshlets;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Transforms the meshlet's vertices once, then clips and rasterizes its
+// triangles.
+template<typename VertexShaderT, typename PixelShaderT>
+void DrawMeshlet( const IndexedMesh& mesh, const Meshlet& meshlet, const Camera& camera,
+	const VertexShaderT& vs, PixelShaderT& ps, RenderTarget& target )
+{
+	typedef ClipVertex<typename VertexShaderT::Out> Clip;
+	Clip shaded[MAX_MESHLET_VERTICES];
+	for (int v = 0; v < meshlet.vertexCount; ++v)
+		vs(camera, mesh, mesh.meshletVertices[meshlet.firstVertex + v], shaded[v]);
+
+	for (int i = meshlet.firstTriangle; i < meshlet.firstTriangle + meshlet.triangleCount; ++i)
+	{
+		const uint8_t* local = &mesh.meshletIndices[3 * i];
+		Clip vertices[3] = { shaded[local[0]], shaded[local[1]], shaded[local[2]] };
+		ps.BeginTriangle(mesh, i);
+		DrawClippedTriangle(vertices, camera, ps, target);
+	}
+}
+
+// Draws triangles of a mesh without meshlets. Vertices go through a
+// post-transform cache so a vertex shared by consecutive triangles is
+// shaded once.
+template<typename VertexShaderT, typename PixelShaderT>
+void DrawTriangles( const IndexedMesh& mesh, int first, int count, const Camera& camera,
+	const VertexShaderT& vs, PixelShaderT& ps, RenderTarget& target, DrawStats* stats )
+{
+	typedef ClipVertex<typename VertexShaderT::Out> Clip;
+	PostTransformCache<Clip> vertexCache;
+
+	for (int i = first; i < first + count; ++i)
+	{
+		Clip vertices[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t index = mesh.indices[3 * i + k];
+			Clip* cached = vertexCache.Lookup(index);
+			if (cached == NULL)
+			{
+				cached = &vertexCache.Insert(index);
+				vs(camera, mesh, index, *cached);
+			}
+			vertices[k] = *cached;
+		}
+
+		ps.BeginTriangle(mesh, i);
+		DrawClippedTriangle(vertices, camera, ps, target);
+	}
+	if (stats != NULL)
+		stats->vertices += vertexCache.Misses();
+}
+
+// Draws the selected objects of an indexed mesh, meshlet by meshlet once
+// they are built.
+template<typename VertexShaderT, typename PixelShaderT>
+void DrawIndexedMesh( const IndexedMesh& mesh, const Camera& camera, const VertexShaderT& vs,
+	PixelShaderT& ps, RenderTarget& target, const DrawSelection& selection = DrawSelection() )
+{
+	DrawStats* stats = selection.stats;
+	for (size_t o = 0; o < mesh.objects.size(); ++o)
+	{
+		if (selection.visible != NULL && !selection.visible[o])
+			continue;
+
+		const MeshLod& lod = mesh.Lod(int(o), selection.lodLevels != NULL ? selection.lodLevels[o] : 0);
+		if (stats != NULL)
+			++stats->objects;
+		if (lod.meshletCount == 0)
+		{
+			DrawTriangles(mesh, lod.firstTriangle, lod.triangleCount, camera, vs, ps, target, stats);
+			if (stats != NULL)
+				stats->triangles += lod.triangleCount;
+			continue;
+		}
+
+		for (int m = lod.firstMeshlet; m < lod.firstMeshlet + lod.meshletCount; ++m)
+		{
+			const Meshlet& meshlet = mesh.meshlets[m];
+			if (stats != NULL)
+				++stats->meshlets;
+			if (!MeshletVisible(meshlet, camera, selection.cullBackfaces, stats))
+				continue;
+
+			DrawMeshlet(mesh, meshlet, camera, vs, ps, target);
+			if (stats != NULL)
+			{
+				stats->vertices += meshlet.vertexCount;
+				stats->triangles += meshlet.triangleCount;
+			}
+		}
+	}
+}
+
+#endif
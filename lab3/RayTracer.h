@@ -0,0 +1,169 @@
+#ifndef RAY_TRACER_H
+#define RAY_TRACER_H
+
+// Ray casting against an indexed mesh, ported from the Lab 2 tracer: a ray
+// start + t dir meets a triangle where it equals v0 + u e1 + v e2, solved
+// for (t, u, v) with Cramer's rule. RayScene tests four triangles at a time
+// and skips objects whose bounding box the ray misses; that is enough for
+// the shadow rays of the hybrid renderer at full screen resolution.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "IndexedMesh.h"
+#include "Simd.h"
+
+// Start offset of shadow rays along the surface normal, against
+// self-intersection (as in Lab 2).
+const float SHADOW_RAY_OFFSET = 0.001f;
+
+// Solves start + t dir = v0 + u e1 + v e2 and returns (t, u, v). The
+// result is only meaningful if dir is not parallel to the plane.
+inline glm::vec3 SolveRay( const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2,
+	const glm::vec3& start, const glm::vec3& dir )
+{
+	glm::vec3 b = start - v0;
+	glm::vec3 n = glm::cross(e1, e2);
+	glm::vec3 q = glm::cross(dir, b);
+	float invDet = -1.0f / glm::dot(dir, n);
+	return glm::vec3(glm::dot(b, n), -glm::dot(e2, q), glm::dot(e1, q)) * invDet;
+}
+
+// Same as SolveRay() for triangle i of the mesh.
+inline glm::vec3 SolveRay( const IndexedMesh& mesh, int i, const glm::vec3& start, const glm::vec3& dir )
+{
+	const glm::vec3& v0 = mesh.positions[mesh.indices[3 * i]];
+	const glm::vec3& v1 = mesh.positions[mesh.indices[3 * i + 1]];
+	const glm::vec3& v2 = mesh.positions[mesh.indices[3 * i + 2]];
+	return SolveRay(v0, v1 - v0, v2 - v0, start, dir);
+}
+
+class RayScene
+{
+public:
+	RayScene() : triangleCount(0) {}
+
+	// Collects the triangles of one level of detail per object (lodLevels
+	// as for DrawIndexedMesh(), full detail if NULL).
+	void Build( const IndexedMesh& mesh, const int* lodLevels = NULL )
+	{
+		objects.clear();
+		groups.clear();
+		triangleCount = 0;
+		for (size_t o = 0; o < mesh.objects.size(); ++o)
+		{
+			const MeshLod& lod = mesh.Lod(int(o), lodLevels != NULL ? lodLevels[o] : 0);
+			Object object = { mesh.objects[o].boundsMin, mesh.objects[o].boundsMax, int(groups.size()),
+				(lod.triangleCount + 3) / 4 };
+			objects.push_back(object);
+
+			// Padding lanes stay zero, degenerate, and never hit.
+			groups.resize(groups.size() + object.groupCount, TriangleGroup());
+			for (int i = 0; i < lod.triangleCount; ++i)
+			{
+				int t = lod.firstTriangle + i;
+				const glm::vec3& v0 = mesh.positions[mesh.indices[3 * t]];
+				glm::vec3 e1 = mesh.positions[mesh.indices[3 * t + 1]] - v0;
+				glm::vec3 e2 = mesh.positions[mesh.indices[3 * t + 2]] - v0;
+				glm::vec3 n = glm::cross(e1, e2);
+				TriangleGroup& group = groups[object.firstGroup + i / 4];
+				for (int c = 0; c < 3; ++c)
+				{
+					group.v0[c][i % 4] = v0[c];
+					group.e1[c][i % 4] = e1[c];
+					group.e2[c][i % 4] = e2[c];
+					group.n[c][i % 4] = n[c];
+				}
+			}
+			triangleCount += lod.triangleCount;
+		}
+	}
+
+	// True if a triangle crosses the segment start + t (end - start),
+	// 0 < t < 1.
+	bool Occluded( const glm::vec3& start, const glm::vec3& end ) const
+	{
+		glm::vec3 dir = end - start;
+		glm::vec3 invDir = 1.0f / dir;
+		Vec3x4 s = Vec3x4::Set1(start);
+		Vec3x4 d = Vec3x4::Set1(dir);
+		const Float4 zero = Float4::Set1(0.0f);
+		const Float4 one = Float4::Set1(1.0f);
+		const Float4 epsilon = Float4::Set1(1e-12f);
+
+		for (size_t o = 0; o < objects.size(); ++o)
+		{
+			const Object& object = objects[o];
+			if (!SegmentHitsBox(start, invDir, object.boundsMin, object.boundsMax))
+				continue;
+
+			for (int g = object.firstGroup; g < object.firstGroup + object.groupCount; ++g)
+			{
+				const TriangleGroup& group = groups[g];
+				Vec3x4 n = Load(group.n);
+				Vec3x4 b = s - Load(group.v0);
+				Vec3x4 q = Cross(d, b);
+				Float4 det = zero - Dot(d, n);
+				Float4 invDet = one / det;
+				Float4 t = Dot(b, n) * invDet;
+				Float4 u = (zero - Dot(Load(group.e2), q)) * invDet;
+				Float4 v = Dot(Load(group.e1), q) * invDet;
+				Float4 hit = (det * det > epsilon) & (t > zero) & (one > t) &
+					(u >= zero) & (v >= zero) & (one >= u + v);
+				if (MoveMask(hit) != 0)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	int TriangleCount() const { return triangleCount; }
+
+private:
+	// Four triangles in structure-of-arrays form: first vertex, edges and
+	// the unnormalized normal e1 x e2.
+	struct TriangleGroup
+	{
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+		float n[3][4];
+	};
+
+	struct Object
+	{
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		int firstGroup;
+		int groupCount;
+	};
+
+	std::vector<Object> objects;
+	std::vector<TriangleGroup> groups;
+	int triangleCount;
+
+	static Vec3x4 Load( const float (*p)[4] )
+	{
+		return Vec3x4(Float4::Load(p[0]), Float4::Load(p[1]), Float4::Load(p[2]));
+	}
+
+	// Slab test of the segment start + t dir, 0 <= t <= 1.
+	static bool SegmentHitsBox( const glm::vec3& start, const glm::vec3& invDir,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax )
+	{
+		float tMin = 0.0f;
+		float tMax = 1.0f;
+		for (int c = 0; c < 3; ++c)
+		{
+			float t0 = (boundsMin[c] - start[c]) * invDir[c];
+			float t1 = (boundsMax[c] - start[c]) * invDir[c];
+			if (t0 > t1)
+				std::swap(t0, t1);
+			tMin = std::max(tMin, t0);
+			tMax = std::min(tMax, t1);
+		}
+		return tMin <= tMax;
+	}
+};
+
+#endif
@@ -1,11 +1,148 @@
 //from https://github.com/lemonad/DH2323-Skeleton
 #include <SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <glm/glm.hpp>
 #include "SDL2Auxiliary.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SDL2AUX_SSE 1
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+// The bulk writes read glm::vec3 arrays as packed floats.
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 is not packed");
+
+
+/*
+* Converts a color with components between 0.0 and 1.0 to a
+* pixel: four bytes, 0xAARRGGBB.
+*/
+static inline Uint32 packColor(float r, float g, float b) {
+	Uint8 red = Uint8(glm::clamp(255 * r, 0.f, 255.f));
+	Uint8 green = Uint8(glm::clamp(255 * g, 0.f, 255.f));
+	Uint8 blue = Uint8(glm::clamp(255 * b, 0.f, 255.f));
+	Uint8 alpha = 255;
+
+	// TODO big endian support?
+	// #if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	// #else
+	// #endif
+
+	return (alpha << 24) + (red << 16) + (green << 8) + blue;
+}
+
+
+#ifdef SDL2AUX_SSE
+/*
+* packColor() for four pixels at once, given as one register
+* per component.
+*/
+static inline __m128i packColors(__m128 r, __m128 g, __m128 b) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 scale = _mm_set1_ps(255.f);
+	__m128i red = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(r, scale), zero), scale));
+	__m128i green = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(g, scale), zero), scale));
+	__m128i blue = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(b, scale), zero), scale));
+	__m128i alpha = _mm_set1_epi32(int(0xff000000));
+	return _mm_or_si128(_mm_or_si128(alpha, _mm_slli_epi32(red, 16)),
+		_mm_or_si128(_mm_slli_epi32(green, 8), blue));
+}
+
+
+/*
+* Loads four colors, stored as r g b r | g b r g | b r g b, into
+* one register per component.
+*/
+static inline void loadColors(const float *c, __m128 &red, __m128 &green, __m128 &blue) {
+	__m128 a = _mm_loadu_ps(c);
+	__m128 b = _mm_loadu_ps(c + 4);
+	__m128 d = _mm_loadu_ps(c + 8);
+	red = _mm_shuffle_ps(a, _mm_shuffle_ps(b, d, _MM_SHUFFLE(1, 1, 2, 2)),
+		_MM_SHUFFLE(2, 0, 3, 0));
+	green = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+		_mm_shuffle_ps(b, d, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+	blue = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+		_mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+#endif
+
+
+// Set by SDL2Aux::setThreadHook().
+static SDL2AuxThreadHook thread_hook = NULL;
+
+
+// The present thread pumps window events at least this often, in
+// milliseconds, while it waits for frames.
+static const int PRESENT_EVENT_INTERVAL = 10;
+
+
+// Frames are compared in tiles of this many pixels square by
+// SDL2AUX_UPLOAD_CHANGED.
+static const int UPLOAD_TILE_SIZE = 32;
+
+
+// sRGB encoding of linear values in [0, 1], in SRGB_LUT_SIZE
+// steps. Even where the curve is steepest, near black, one step
+// is less than one 8-bit level.
+static const int SRGB_LUT_SIZE = 4096;
+static Uint8 srgbLut[SRGB_LUT_SIZE];
+
+
+static void buildSrgbLut() {
+	for (int i = 0; i < SRGB_LUT_SIZE; ++i) {
+		float linear = float(i) / (SRGB_LUT_SIZE - 1);
+		float encoded = linear <= 0.0031308f ? 12.92f * linear :
+			1.055f * pow(linear, 1 / 2.4f) - 0.055f;
+		srgbLut[i] = Uint8(255 * encoded + 0.5f);
+	}
+}
+
+
+/*
+* Resolves an HDR color component: scales it by exposure, tone
+* maps it and returns its 8-bit sRGB value. Negative values
+* (and NaN) become black.
+*/
+static inline Uint8 resolveComponent(float c, SDL2AuxToneMap tone_map, float exposure) {
+	c = max(0.f, c * exposure);
+	if (tone_map == SDL2AUX_REINHARD) {
+		c = c / (1 + c);
+	} else if (tone_map == SDL2AUX_ACES) {
+		c = (c * (2.51f * c + 0.03f)) / (c * (2.43f * c + 0.59f) + 0.14f);
+	}
+	return srgbLut[int(min(float(SRGB_LUT_SIZE - 1), c * (SRGB_LUT_SIZE - 1) + 0.5f))];
+}
+
+
+#ifdef SDL2AUX_SSE
+/*
+* resolveComponent() for four values at once, returned as LUT
+* indices.
+*/
+static inline __m128i resolveComponents(__m128 c, SDL2AuxToneMap tone_map, float exposure) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 last = _mm_set1_ps(float(SRGB_LUT_SIZE - 1));
+	c = _mm_max_ps(_mm_mul_ps(c, _mm_set1_ps(exposure)), zero);
+	if (tone_map == SDL2AUX_REINHARD) {
+		c = _mm_div_ps(c, _mm_add_ps(one, c));
+	} else if (tone_map == SDL2AUX_ACES) {
+		__m128 numerator = _mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), c),
+			_mm_set1_ps(0.03f)));
+		__m128 denominator = _mm_add_ps(_mm_mul_ps(c, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), c),
+			_mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		c = _mm_div_ps(numerator, denominator);
+	}
+	c = _mm_add_ps(_mm_mul_ps(c, last), _mm_set1_ps(0.5f));
+	return _mm_cvttps_epi32(_mm_min_ps(c, last));
+}
+#endif
+
 /*
 * Construct a window with an associated pixel buffer to
 * draw into.
@@ -14,43 +151,140 @@ using namespace std;
 * to the desktop size (but resolution is not changed).
 * In this case, width and height is only used for the
 * size of the pixel buffer.
+*
+* With SDL2AUX_LOCK, pixels are written straight into the
+* locked streaming texture instead of a separate pixel buffer,
+* which saves copying the whole frame in render(). Locked
+* texture memory starts out undefined, so every pixel has to
+* be drawn (or cleared) each frame. If the texture cannot be
+* locked, the pixel buffer is used after all.
+*
+* With 2 or 3 buffers (double or triple buffering), render()
+* hands the finished frame to a present thread, which uploads
+* and presents it while the next frame is drawn into another
+* buffer. render() then only waits when no buffer is free, and
+* never for the vertical blank itself. Buffers are reused in
+* turn, so they hold an older frame when drawing starts. As SDL
+* renders only on the thread that created the window, the
+* present thread starts SDL video and owns the window as well,
+* pumping its events; the keyboard state and quitEvent() still
+* work from the calling thread. The lock framebuffer only
+* applies to a single buffer, presented by render() on the
+* calling thread; SDL2AUX_MAILBOX is the same as SDL2AUX_VSYNC
+* then.
+*
+* SDL2AUX_HEADLESS draws into a single pixel buffer without a
+* window, renderer or texture, so it runs on machines without a
+* display. fullscreen and the framebuffer are ignored, and
+* render() only passes the frame to the frame sink, if any.
 */
-SDL2Aux::SDL2Aux(int width, int height, bool fullscreen) {
+SDL2Aux::SDL2Aux(int width, int height, bool fullscreen,
+	SDL2AuxFramebuffer framebuffer, SDL2AuxPresent present,
+	int buffering) {
 	this->width = width;
 	this->height = height;
 	this->fullscreen = fullscreen;
+	this->framebuffer = framebuffer;
+	this->present = present;
+	buffer_count = glm::clamp(buffering, 1, 3);
+
+#ifdef __APPLE__
+	// SDL can only render from the main thread on macOS.
+	buffer_count = 1;
+#endif
+	if (present == SDL2AUX_HEADLESS) {
+		this->fullscreen = false;
+		buffer_count = 1;
+	}
+	if (framebuffer == SDL2AUX_LOCK && (buffer_count > 1 || present == SDL2AUX_HEADLESS)) {
+		cout << "The lock framebuffer needs a single buffer and a window, "
+			"copying frames instead." << endl;
+		this->framebuffer = SDL2AUX_COPY;
+	}
 
 	if (!initializeSDL() ||
-		!createWindow() ||
-		!createRenderer() ||
-		!createTexture() ||
-		!createPixelBuffer()) {
+		!createClearTags() ||
+		(this->framebuffer == SDL2AUX_COPY && !createPixelBuffer()) ||
+		(present != SDL2AUX_HEADLESS && !startPresenting())) {
 		cout << "Could not initialize SDLAux. Exiting." << endl;
 		exit(1);
 	}
 
+	if (this->framebuffer == SDL2AUX_LOCK) {
+		lockFrame();
+	} else {
+		frame = pixel_buffer;
+		frame_stride = width;
+	}
+
 	atexit(SDL_Quit);
 }
 
 
 /*
-* Free allocated pixel buffer. We don't have to destroy SDL
-* objects here because that is taken care of by SDL_Quit.
+* Stop the present thread and free allocated pixel buffers.
+* We don't have to destroy SDL objects here because that is
+* taken care of by SDL_Quit.
 */
 SDL2Aux::~SDL2Aux() {
-	if (pixel_buffer != NULL) {
-		free(pixel_buffer);
+	if (present_thread != NULL) {
+		SDL_LockMutex(present_mutex);
+		present_quit = true;
+		SDL_CondBroadcast(present_cond);
+		SDL_UnlockMutex(present_mutex);
+		SDL_WaitThread(present_thread, NULL);
+	}
+	if (present_cond != NULL) {
+		SDL_DestroyCond(present_cond);
+	}
+	if (present_mutex != NULL) {
+		SDL_DestroyMutex(present_mutex);
+	}
+
+	for (int i = 0; i < buffer_count; ++i) {
+		if (buffers[i] != NULL) {
+			free(buffers[i]);
+		}
+	}
+
+	if (resolve_helper_count > 0) {
+		SDL_LockMutex(resolve_mutex);
+		resolve_quit = true;
+		SDL_CondBroadcast(resolve_cond);
+		SDL_UnlockMutex(resolve_mutex);
+		for (int i = 0; i < resolve_helper_count; ++i) {
+			SDL_WaitThread(resolve_helpers[i].thread, NULL);
+		}
+	}
+	if (resolve_cond != NULL) {
+		SDL_DestroyCond(resolve_cond);
+	}
+	if (resolve_mutex != NULL) {
+		SDL_DestroyMutex(resolve_mutex);
+	}
+	if (hdr_buffer != NULL) {
+		free(hdr_buffer);
+	}
+	if (uploaded != NULL) {
+		free(uploaded);
+	}
+	if (clear_tags != NULL) {
+		free(clear_tags);
 	}
 }
 
 
 /*
-* Sets up SDL (video and timer) for per pixel drawing.
+* Sets up SDL (video and timer) for per pixel drawing. Headless,
+* or when video is left to the present thread, events take the
+* place of video, for quitEvent().
 *
 * Returns true on success.
 */
 bool SDL2Aux::initializeSDL() {
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
+	Uint32 subsystems = present == SDL2AUX_HEADLESS || buffer_count > 1 ?
+		SDL_INIT_EVENTS : SDL_INIT_VIDEO;
+	if (SDL_Init(subsystems | SDL_INIT_TIMER) < 0) {
 		cout << "Could not initialize SDL: " << SDL_GetError() << endl;
 		return false;
 	}
@@ -96,7 +330,7 @@ bool SDL2Aux::createRenderer() {
 	// priority to available hardware accelerated renderers.)
 	sdl_renderer = SDL_CreateRenderer(sdl_window,
 		-1,
-		SDL_RENDERER_PRESENTVSYNC);
+		present == SDL2AUX_UNCAPPED ? 0 : SDL_RENDERER_PRESENTVSYNC);
 	if (sdl_renderer == NULL) {
 		cout << "Could not create SDL renderer: " << SDL_GetError() << endl;
 		return false;
@@ -135,14 +369,17 @@ bool SDL2Aux::createTexture() {
 
 
 /*
-* Create the pixel buffer for per-pixel drawing into.
+* Creates the tags of the tiles clearPixels() clears. They start
+* out current, so nothing is cleared before clearPixels().
 *
 * Returns true on success.
 */
-bool SDL2Aux::createPixelBuffer() {
-	pixel_buffer = (Uint32 *)calloc(width * height, sizeof(Uint32));
-	if (pixel_buffer == NULL) {
-		cout << "Could not create SDL pixel buffer." << endl;
+bool SDL2Aux::createClearTags() {
+	clear_tiles_x = (width + SDL2AUX_CLEAR_TILE_SIZE - 1) >> SDL2AUX_CLEAR_TILE_SHIFT;
+	clear_tiles_y = (height + SDL2AUX_CLEAR_TILE_SIZE - 1) >> SDL2AUX_CLEAR_TILE_SHIFT;
+	clear_tags = (Uint32 *)calloc(clear_tiles_x * clear_tiles_y, sizeof(Uint32));
+	if (clear_tags == NULL) {
+		cout << "Could not create SDL2Aux clear tags." << endl;
 		return false;
 	}
 
@@ -151,17 +388,397 @@ bool SDL2Aux::createPixelBuffer() {
 
 
 /*
-* Clears the pixel buffer (i.e. sets it to black).
+* Create the pixel buffers for per-pixel drawing into.
+*
+* Returns true on success.
+*/
+bool SDL2Aux::createPixelBuffer() {
+	for (int i = 0; i < buffer_count; ++i) {
+		buffers[i] = (Uint32 *)calloc(width * height, sizeof(Uint32));
+		if (buffers[i] == NULL) {
+			cout << "Could not create SDL pixel buffer." << endl;
+			return false;
+		}
+	}
+
+	pixel_buffer = buffers[drawing];
+	return true;
+}
+
+
+/*
+* Creates the window, renderer and texture: on the calling
+* thread for a single buffer, otherwise on a new present thread,
+* as SDL only renders on the thread that created the window.
+*
+* Returns true on success.
+*/
+bool SDL2Aux::startPresenting() {
+	if (buffer_count == 1) {
+		return createWindow() && createRenderer() && createTexture();
+	}
+
+	present_mutex = SDL_CreateMutex();
+	present_cond = SDL_CreateCond();
+	if (present_mutex == NULL || present_cond == NULL) {
+		cout << "Could not create SDL mutex: " << SDL_GetError() << endl;
+		return false;
+	}
+
+	// The first buffer is drawn first, the others are spare.
+	for (int i = 1; i < buffer_count; ++i) {
+		spare[spare_count++] = i;
+	}
+
+	present_thread = SDL_CreateThread(presentThread, "SDL2Aux present", this);
+	if (present_thread == NULL) {
+		cout << "Could not create SDL present thread: " << SDL_GetError() << endl;
+		return false;
+	}
+
+	SDL_LockMutex(present_mutex);
+	while (present_status == 0) {
+		SDL_CondWait(present_cond, present_mutex);
+	}
+	SDL_UnlockMutex(present_mutex);
+	return present_status > 0;
+}
+
+
+int SDL2Aux::presentThread(void *data) {
+	threadStarted("SDL2Aux present");
+	return ((SDL2Aux *)data)->presentFrames();
+}
+
+
+/*
+* Body of the present thread: starts SDL video, then uploads and
+* presents ready frames until the destructor stops it. Events
+* are pumped at least every PRESENT_EVENT_INTERVAL milliseconds
+* meanwhile, for quitEvent() and the keyboard state.
+*/
+int SDL2Aux::presentFrames() {
+	bool created = false;
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
+		cout << "Could not initialize SDL video: " << SDL_GetError() << endl;
+	} else {
+		created = createWindow() && createRenderer() && createTexture();
+	}
+	SDL_LockMutex(present_mutex);
+	present_status = created ? 1 : -1;
+	SDL_CondBroadcast(present_cond);
+	SDL_UnlockMutex(present_mutex);
+	if (!created) {
+		return 1;
+	}
+
+	for (;;) {
+		SDL_PumpEvents();
+
+		SDL_LockMutex(present_mutex);
+		if (title_changed) {
+			SDL_SetWindowTitle(sdl_window, window_title);
+			title_changed = false;
+		}
+		while (ready_count == 0 && !present_quit) {
+			if (SDL_CondWaitTimeout(present_cond, present_mutex,
+				PRESENT_EVENT_INTERVAL) == SDL_MUTEX_TIMEDOUT) {
+				break;
+			}
+		}
+		if (present_quit) {
+			SDL_UnlockMutex(present_mutex);
+			break;
+		}
+		if (ready_count == 0) {
+			SDL_UnlockMutex(present_mutex);
+			continue;
+		}
+
+		int buffer = ready[0];
+		--ready_count;
+		for (int i = 0; i < ready_count; ++i) {
+			ready[i] = ready[i + 1];
+		}
+		SDL2AuxUpload frame_upload = upload;
+		SDL_UnlockMutex(present_mutex);
+
+		uploadFrame(buffers[buffer], frame_upload);
+
+		// The texture has the frame now, so its buffer can be drawn
+		// into again while the present waits for the vertical blank.
+		SDL_LockMutex(present_mutex);
+		spare[spare_count++] = buffer;
+		SDL_CondBroadcast(present_cond);
+		SDL_UnlockMutex(present_mutex);
+
+		SDL_RenderClear(sdl_renderer);
+		SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
+		SDL_RenderPresent(sdl_renderer);
+	}
+
+	SDL_DestroyTexture(sdl_texture);
+	SDL_DestroyRenderer(sdl_renderer);
+	SDL_DestroyWindow(sdl_window);
+	SDL_QuitSubSystem(SDL_INIT_VIDEO);
+	return 0;
+}
+
+
+/*
+* Copies a frame from a pixel buffer to the texture, either all
+* of it or only what changed since the last upload.
+*/
+void SDL2Aux::uploadFrame(const Uint32 *pixels, SDL2AuxUpload upload) {
+	if (upload == SDL2AUX_UPLOAD_CHANGED && uploaded_valid) {
+		uploadChanged(pixels);
+		return;
+	}
+
+	SDL_UpdateTexture(sdl_texture,
+		NULL,
+		pixels,
+		width * sizeof(Uint32));
+
+	uploaded_valid = false;
+	if (upload == SDL2AUX_UPLOAD_CHANGED) {
+		if (uploaded == NULL) {
+			uploaded = (Uint32 *)malloc(width * height * sizeof(Uint32));
+		}
+		if (uploaded != NULL) {
+			memcpy(uploaded, pixels, width * height * sizeof(Uint32));
+			uploaded_valid = true;
+		}
+	}
+}
+
+
+/*
+* Uploads the UPLOAD_TILE_SIZE square tiles of a frame that
+* differ from uploaded, and copies them into it. Changed tiles
+* next to each other in a row of tiles go up as one rectangle.
+*/
+void SDL2Aux::uploadChanged(const Uint32 *pixels) {
+	int tiles_x = (width + UPLOAD_TILE_SIZE - 1) / UPLOAD_TILE_SIZE;
+
+	for (int y = 0; y < height; y += UPLOAD_TILE_SIZE) {
+		int rows = min(UPLOAD_TILE_SIZE, height - y);
+		int run_start = -1;
+
+		// One past the last tile, to upload a run reaching the edge.
+		for (int tile = 0; tile <= tiles_x; ++tile) {
+			bool changed = false;
+			if (tile < tiles_x) {
+				int x = tile * UPLOAD_TILE_SIZE;
+				int columns = min(UPLOAD_TILE_SIZE, width - x);
+				for (int row = y; row < y + rows; ++row) {
+					const Uint32 *pixel = pixels + row * width + x;
+					Uint32 *mirror = uploaded + row * width + x;
+					if (memcmp(pixel, mirror, columns * sizeof(Uint32)) != 0) {
+						memcpy(mirror, pixel, columns * sizeof(Uint32));
+						changed = true;
+					}
+				}
+			}
+
+			if (changed && run_start < 0) {
+				run_start = tile;
+			} else if (!changed && run_start >= 0) {
+				SDL_Rect rect;
+				rect.x = run_start * UPLOAD_TILE_SIZE;
+				rect.y = y;
+				rect.w = min(tile * UPLOAD_TILE_SIZE, width) - rect.x;
+				rect.h = rows;
+				SDL_UpdateTexture(sdl_texture,
+					&rect,
+					pixels + y * width + rect.x,
+					width * sizeof(Uint32));
+				run_start = -1;
+			}
+		}
+	}
+}
+
+
+/*
+* Hands the frame drawn to the present thread and switches to a
+* spare buffer for the next one, waiting until there is one.
+*/
+void SDL2Aux::queueFrame() {
+	SDL_LockMutex(present_mutex);
+	if (present != SDL2AUX_VSYNC) {
+		// Only the newest frame gets presented.
+		while (ready_count > 0) {
+			spare[spare_count++] = ready[--ready_count];
+		}
+	}
+	ready[ready_count++] = drawing;
+	finished = drawing;
+	SDL_CondBroadcast(present_cond);
+
+	while (spare_count == 0) {
+		SDL_CondWait(present_cond, present_mutex);
+	}
+	drawing = spare[--spare_count];
+	SDL_UnlockMutex(present_mutex);
+
+	pixel_buffer = buffers[drawing];
+	frame = pixel_buffer;
+}
+
+
+/*
+* Locks the texture for drawing the next frame into. If that
+* fails, falls back to the pixel buffer for good, as some
+* backends cannot lock streaming textures.
+*/
+void SDL2Aux::lockFrame() {
+	void *locked;
+	int locked_pitch;
+	if (framebuffer == SDL2AUX_LOCK &&
+		SDL_LockTexture(sdl_texture, NULL, &locked, &locked_pitch) == 0) {
+		frame = (Uint32 *)locked;
+		frame_stride = locked_pitch / sizeof(Uint32);
+		return;
+	}
+
+	if (framebuffer == SDL2AUX_LOCK) {
+		cout << "Could not lock SDL texture, copying frames instead: "
+			<< SDL_GetError() << endl;
+		framebuffer = SDL2AUX_COPY;
+	}
+	if (pixel_buffer == NULL && !createPixelBuffer()) {
+		exit(1);
+	}
+	frame = pixel_buffer;
+	frame_stride = width;
+}
+
+
+/*
+* Returns the frame being drawn, for writing pixels directly.
+* Rows are pitch() bytes apart. The pointer changes in render(),
+* so fetch it again for every frame. Tiles still waiting to be
+* cleared are cleared first.
+*/
+Uint32 *SDL2Aux::pixels() {
+	clearUntouched();
+	return frame;
+}
+
+
+/*
+* Returns the distance in bytes between rows of pixels().
+*/
+int SDL2Aux::pitch() {
+	return frame_stride * sizeof(Uint32);
+}
+
+
+/*
+* Clears the pixel buffer (i.e. sets it to black). Only a new
+* clear generation starts here: each SDL2AUX_CLEAR_TILE_SIZE square tile
+* is cleared when it is first written to, and the tiles nothing
+* wrote to when the frame is rendered (or pixels() fetched).
+* Tiles a write covers completely are not cleared at all.
 */
 void SDL2Aux::clearPixels() {
-	memset(pixel_buffer, 0, width * height * sizeof(Uint32));
+	// Tags only need to differ from the current generation, but not
+	// for an old value to come around again after wrapping.
+	if (++clear_generation == 0) {
+		memset(clear_tags, 0, clear_tiles_x * clear_tiles_y * sizeof(Uint32));
+		clear_generation = 1;
+	}
+}
+
+
+/*
+* Clears a tile of the frame, or of the HDR buffer with HDR, and
+* tags it with the current generation.
+*/
+void SDL2Aux::clearTile(int tile) {
+	clear_tags[tile] = clear_generation;
+
+	int x = (tile % clear_tiles_x) * SDL2AUX_CLEAR_TILE_SIZE;
+	int y = (tile / clear_tiles_x) * SDL2AUX_CLEAR_TILE_SIZE;
+	int columns = min(SDL2AUX_CLEAR_TILE_SIZE, width - x);
+	int last_row = min(y + SDL2AUX_CLEAR_TILE_SIZE, height);
+	for (int row = y; row < last_row; ++row) {
+		if (hdr) {
+			memset(hdr_buffer + 3 * (row * width + x), 0, columns * sizeof(glm::vec3));
+		} else {
+			memset(frame + row * frame_stride + x, 0, columns * sizeof(Uint32));
+		}
+	}
+}
+
+
+/*
+* Clears the tiles a span is about to be written to, if they have
+* not been since clearPixels(). The span may run on into the next
+* rows.
+*/
+void SDL2Aux::touchSpan(int x, int y, int count) {
+	for (; count > 0; x = 0, ++y) {
+		int columns = min(count, width - x);
+		int row = (y >> SDL2AUX_CLEAR_TILE_SHIFT) * clear_tiles_x;
+		int last = row + ((x + columns - 1) >> SDL2AUX_CLEAR_TILE_SHIFT);
+		for (int tile = row + (x >> SDL2AUX_CLEAR_TILE_SHIFT); tile <= last; ++tile) {
+			if (clear_tags[tile] != clear_generation) {
+				clearTile(tile);
+			}
+		}
+		count -= columns;
+	}
+}
+
+
+/*
+* touchSpan() for a block of rows. Tiles the block covers
+* completely only get tagged.
+*/
+void SDL2Aux::touchBlock(int x, int y, int block_width, int block_height) {
+	int x_end = x + block_width;
+	int y_end = y + block_height;
+	int last_x = (x_end - 1) >> SDL2AUX_CLEAR_TILE_SHIFT;
+	int last_y = (y_end - 1) >> SDL2AUX_CLEAR_TILE_SHIFT;
+	for (int tile_y = y >> SDL2AUX_CLEAR_TILE_SHIFT; tile_y <= last_y; ++tile_y) {
+		int top = tile_y * SDL2AUX_CLEAR_TILE_SIZE;
+		bool rows_covered = y <= top && min(top + SDL2AUX_CLEAR_TILE_SIZE, height) <= y_end;
+		for (int tile_x = x >> SDL2AUX_CLEAR_TILE_SHIFT; tile_x <= last_x; ++tile_x) {
+			int tile = tile_y * clear_tiles_x + tile_x;
+			if (clear_tags[tile] == clear_generation) {
+				continue;
+			}
+			int left = tile_x * SDL2AUX_CLEAR_TILE_SIZE;
+			if (rows_covered && x <= left && min(left + SDL2AUX_CLEAR_TILE_SIZE, width) <= x_end) {
+				clear_tags[tile] = clear_generation;
+			} else {
+				clearTile(tile);
+			}
+		}
+	}
+}
+
+
+/*
+* Clears every tile still waiting for it since clearPixels().
+*/
+void SDL2Aux::clearUntouched() {
+	int tiles = clear_tiles_x * clear_tiles_y;
+	for (int tile = 0; tile < tiles; ++tile) {
+		if (clear_tags[tile] != clear_generation) {
+			clearTile(tile);
+		}
+	}
 }
 
 
 /*
 * Update a pixel in the pixel buffer. The color is represented
 * by a glm:vec3 which specifies the red, green and blue components
-* with numbers between 0.0 and 1.0 (inclusive).
+* with numbers between 0.0 and 1.0 (inclusive), or any linear
+* value with HDR.
 */
 void SDL2Aux::putPixel(int x, int y, glm::vec3 color) {
 	if (x < 0 || x >= width ||
@@ -169,54 +786,196 @@ void SDL2Aux::putPixel(int x, int y, glm::vec3 color) {
 		return;
 	}
 
-	Uint8 red = Uint8(glm::clamp(255 * color.r, 0.f, 255.f));
-	Uint8 green = Uint8(glm::clamp(255 * color.g, 0.f, 255.f));
-	Uint8 blue = Uint8(glm::clamp(255 * color.b, 0.f, 255.f));
-	Uint8 alpha = 255;
+	touchSpan(x, y, 1);
 
-	// Each pixel in the pixel buffer consists of four bytes: 0xAARRGGBB.
-	Uint32 rgba = (alpha << 24) + (red << 16) + (green << 8) + blue;
+	if (hdr) {
+		float *c = hdr_buffer + 3 * (y * width + x);
+		c[0] = color.r;
+		c[1] = color.g;
+		c[2] = color.b;
+		return;
+	}
 
 	// Calculate the address of the pixel we want to set.
-	Uint32* pixel = (Uint32 *)pixel_buffer + y * width + x;
+	Uint32* pixel = frame + y * frame_stride + x;
 
-	// TODO big endian support?
-	// #if SDL_BYTEORDER == SDL_BIG_ENDIAN
-	// #else
-	// #endif
+	*pixel = packColor(color.r, color.g, color.b);
+}
+
+
+/*
+* Writes count pixels starting at (x, y) and going right, with
+* colors as in putPixel(). Unlike putPixel(), nothing is checked:
+* the whole span has to lie inside the pixel buffer.
+*/
+void SDL2Aux::putSpan(int x, int y, int count, const glm::vec3 *colors) {
+	touchSpan(x, y, count);
+	writeSpan(x, y, count, colors);
+}
+
+
+/*
+* Writes a span like putSpan(), without clearing tiles first.
+*/
+void SDL2Aux::writeSpan(int x, int y, int count, const glm::vec3 *colors) {
+	if (hdr) {
+		memcpy(hdr_buffer + 3 * (y * width + x), colors, count * sizeof(glm::vec3));
+		return;
+	}
+
+	Uint32 *pixel = frame + y * frame_stride + x;
+	const float *c = &colors[0].x;
+	int i = 0;
 
-	*pixel = rgba;
+#ifdef SDL2AUX_SSE
+	// Four colors at a time.
+	for (; i + 4 <= count; i += 4, c += 12) {
+		__m128 red, green, blue;
+		loadColors(c, red, green, blue);
+		_mm_storeu_si128((__m128i *)(pixel + i), packColors(red, green, blue));
+	}
+#endif
+
+	for (; i < count; ++i, c += 3) {
+		pixel[i] = packColor(c[0], c[1], c[2]);
+	}
 }
 
 
 /*
-* Use the pixel buffer to update the texture, then render the
-* texture into the window/screen.
+* putSpan() for colors given as separate arrays of red, green
+* and blue.
+*/
+void SDL2Aux::putSpan(int x, int y, int count,
+	const float *red, const float *green, const float *blue) {
+	touchSpan(x, y, count);
+
+	if (hdr) {
+		float *c = hdr_buffer + 3 * (y * width + x);
+		for (int i = 0; i < count; ++i, c += 3) {
+			c[0] = red[i];
+			c[1] = green[i];
+			c[2] = blue[i];
+		}
+		return;
+	}
+
+	Uint32 *pixel = frame + y * frame_stride + x;
+	int i = 0;
+
+#ifdef SDL2AUX_SSE
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_si128((__m128i *)(pixel + i), packColors(_mm_loadu_ps(red + i),
+			_mm_loadu_ps(green + i), _mm_loadu_ps(blue + i)));
+	}
+#endif
+
+	for (; i < count; ++i) {
+		pixel[i] = packColor(red[i], green[i], blue[i]);
+	}
+}
+
+
+/*
+* Writes a tile_width x tile_height block of pixels with its top
+* left corner at (x, y). Rows of colors are stride elements
+* apart. As with putSpan(), the block must lie inside the pixel
+* buffer. Threads may write blocks at once only as described at
+* SDL2AUX_CLEAR_TILE_SIZE.
+*/
+void SDL2Aux::putTile(int x, int y, int tile_width, int tile_height,
+	const glm::vec3 *colors, int stride) {
+	touchBlock(x, y, tile_width, tile_height);
+	for (int row = 0; row < tile_height; ++row) {
+		writeSpan(x, y + row, tile_width, colors + row * stride);
+	}
+}
+
+
+/*
+* Writes the whole pixel buffer from width x height colors, row
+* after row.
+*/
+void SDL2Aux::putFrame(const glm::vec3 *colors) {
+	if (frame_stride == width) {
+		touchBlock(0, 0, width, height);
+		writeSpan(0, 0, width * height, colors);
+		return;
+	}
+
+	putTile(0, 0, width, height, colors, width);
+}
+
+
+/*
+* Use the pixel buffer to update the texture (or unlock the
+* texture drawn into), then render the texture into the
+* window/screen. With a present thread, this is left to it.
+*
+* Tiles nothing was written to since clearPixels() are cleared
+* first. With HDR, the frame is then resolved into the pixel
+* buffer. The frame sink, if set, sees the frame next.
 */
 void SDL2Aux::render() {
-	SDL_UpdateTexture(sdl_texture,
-		NULL,
-		pixel_buffer,
-		width * sizeof(Uint32));
+	clearUntouched();
+
+	if (hdr) {
+		resolveHDR();
+	}
+
+	if (sink != NULL) {
+		sink(frame, width, height, pitch(), sink_data);
+	}
+
+	if (present == SDL2AUX_HEADLESS) {
+		return;
+	}
+
+	if (buffer_count > 1) {
+		queueFrame();
+		return;
+	}
+
+	if (framebuffer == SDL2AUX_LOCK) {
+		SDL_UnlockTexture(sdl_texture);
+	} else {
+		uploadFrame(pixel_buffer, upload);
+	}
 
 	SDL_RenderClear(sdl_renderer);
 	SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
 	SDL_RenderPresent(sdl_renderer);
+
+	if (framebuffer == SDL2AUX_LOCK) {
+		lockFrame();
+	}
 }
 
 
 /*
 * Save pixel buffer as a bitmap file.
 *
+* With a present thread, the last frame passed to render() is
+* saved. With SDL2AUX_LOCK and a window there is nothing to save
+* from: render() hands the frame to SDL and locks the texture
+* again, whose contents SDL leaves undefined.
+*
 * Returns true on success.
 */
 bool SDL2Aux::saveBMP(const char *filename) {
+	if (framebuffer == SDL2AUX_LOCK) {
+		cout << "Could not save bitmap: the locked texture does not keep "
+			<< "the last frame, use SDL2AUX_COPY" << endl;
+		return false;
+	}
+
 	// TODO big endian support?
-	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(pixel_buffer,
+	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(
+		buffer_count > 1 ? buffers[finished] : frame,
 		width,
 		height,
 		32,
-		width * 4,
+		pitch(),
 		0, 0, 0, 0);
 	if (surface == NULL) {
 		cout << "Could not create SDL surface for bitmap: "
@@ -234,12 +993,17 @@ bool SDL2Aux::saveBMP(const char *filename) {
 * Goes through the SDL event queue looking for events corresponding
 * to the user wanting to quit/exit.
 *
+* With a present thread, which pumps the events, they are only
+* taken from the queue here.
+*
 * Returns true if a quit event was received.
 */
 bool SDL2Aux::quitEvent() {
 	SDL_Event event;
 
-	while (SDL_PollEvent(&event)) {
+	while (present_thread != NULL ?
+		SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0 :
+		SDL_PollEvent(&event)) {
 		if (event.type == SDL_QUIT) {
 			return true;
 		}
@@ -256,8 +1020,239 @@ bool SDL2Aux::quitEvent() {
 
 
 /*
-* Updates the window title.
+* Updates the window title, if there is a window. With a present
+* thread, the title is set there.
 */
 void SDL2Aux::setWindowTitle(const char *title) {
-	SDL_SetWindowTitle(sdl_window, title);
-}
\ No newline at end of file
+	if (present_thread != NULL) {
+		SDL_LockMutex(present_mutex);
+		snprintf(window_title, sizeof(window_title), "%s", title);
+		title_changed = true;
+		SDL_UnlockMutex(present_mutex);
+	} else if (sdl_window != NULL) {
+		SDL_SetWindowTitle(sdl_window, title);
+	}
+}
+
+
+/*
+* Sets the function that render() passes each frame to, e.g.
+* to record them; NULL removes it. It runs on the thread
+* calling render(), before the frame is presented.
+*/
+void SDL2Aux::setFrameSink(SDL2AuxFrameSink sink, void *user_data) {
+	this->sink = sink;
+	sink_data = user_data;
+}
+
+
+/*
+* Sets the function run first on every thread started from now
+* on by SDL2Aux and the writers; NULL removes it. Set it before
+* creating them, since it is not synchronized.
+*/
+void SDL2Aux::setThreadHook(SDL2AuxThreadHook hook) {
+	thread_hook = hook;
+}
+
+
+/*
+* Called by each thread SDL2Aux or the writers start, before it
+* does anything else.
+*/
+void SDL2Aux::threadStarted(const char *name) {
+	if (thread_hook != NULL) {
+		thread_hook(name);
+	}
+}
+
+
+/*
+* Makes putPixel() and the other writes store linear float
+* colors, unclamped, in an HDR buffer. render() then resolves
+* it into the pixel buffer once per frame: each component is
+* multiplied by exposure, tone mapped and encoded as sRGB. The
+* HDR buffer and the helper threads of the resolve are set up
+* by the first call; later calls only change the settings.
+*
+* Writing to pixels() directly has no effect with HDR, as
+* render() overwrites them.
+*/
+void SDL2Aux::enableHDR(SDL2AuxToneMap tone_map, float exposure) {
+	if (hdr_buffer == NULL) {
+		hdr_buffer = (float *)calloc(width * height, sizeof(glm::vec3));
+		if (hdr_buffer == NULL) {
+			cout << "Could not allocate HDR buffer." << endl;
+			return;
+		}
+		buildSrgbLut();
+		startResolving();
+	}
+
+	hdr = true;
+	this->tone_map = tone_map;
+	this->exposure = exposure;
+}
+
+
+/*
+* Goes back to writing 8-bit pixels directly. The HDR buffer is
+* kept for the next enableHDR().
+*/
+void SDL2Aux::disableHDR() {
+	hdr = false;
+}
+
+
+/*
+* Starts a helper thread for each processor beyond the first (up
+* to seven), each resolving its own band of rows. Without them,
+* render() resolves every row itself.
+*/
+void SDL2Aux::startResolving() {
+	int count = glm::clamp(SDL_GetCPUCount() - 1, 0, 7);
+	if (count == 0) {
+		return;
+	}
+
+	resolve_mutex = SDL_CreateMutex();
+	resolve_cond = SDL_CreateCond();
+	if (resolve_mutex == NULL || resolve_cond == NULL) {
+		cout << "Could not create HDR resolve threads: " << SDL_GetError() << endl;
+		return;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		ResolveHelper &helper = resolve_helpers[i];
+		helper.aux = this;
+		helper.band = i + 1;
+		helper.thread = SDL_CreateThread(resolveThread, "SDL2Aux resolve", &helper);
+		if (helper.thread == NULL) {
+			break;
+		}
+		++resolve_helper_count;
+	}
+}
+
+
+/*
+* Resolves the HDR buffer into the pixel buffer, band 0 on this
+* thread and the others on the helper threads. Returns when all
+* bands are done.
+*/
+void SDL2Aux::resolveHDR() {
+	if (resolve_helper_count == 0) {
+		resolveBand(0);
+		return;
+	}
+
+	SDL_LockMutex(resolve_mutex);
+	++resolve_generation;
+	resolve_pending = resolve_helper_count;
+	SDL_CondBroadcast(resolve_cond);
+	SDL_UnlockMutex(resolve_mutex);
+
+	resolveBand(0);
+
+	SDL_LockMutex(resolve_mutex);
+	while (resolve_pending > 0) {
+		SDL_CondWait(resolve_cond, resolve_mutex);
+	}
+	SDL_UnlockMutex(resolve_mutex);
+}
+
+
+/*
+* Resolves one of resolve_helper_count + 1 equal bands of rows.
+*/
+void SDL2Aux::resolveBand(int band) {
+	int bands = resolve_helper_count + 1;
+	int last_row = (band + 1) * height / bands;
+
+	for (int y = band * height / bands; y < last_row; ++y) {
+		const float *c = hdr_buffer + 3 * y * width;
+		Uint32 *pixel = frame + y * frame_stride;
+		int x = 0;
+
+#ifdef SDL2AUX_SSE
+		// Four pixels at a time, up to the table lookups.
+		for (; x + 4 <= width; x += 4, c += 12) {
+			__m128 red, green, blue;
+			loadColors(c, red, green, blue);
+			int r[4], g[4], b[4];
+			_mm_storeu_si128((__m128i *)r, resolveComponents(red, tone_map, exposure));
+			_mm_storeu_si128((__m128i *)g, resolveComponents(green, tone_map, exposure));
+			_mm_storeu_si128((__m128i *)b, resolveComponents(blue, tone_map, exposure));
+			for (int i = 0; i < 4; ++i) {
+				pixel[x + i] = 0xff000000 | (srgbLut[r[i]] << 16) |
+					(srgbLut[g[i]] << 8) | srgbLut[b[i]];
+			}
+		}
+#endif
+
+		for (; x < width; ++x, c += 3) {
+			pixel[x] = 0xff000000 | (resolveComponent(c[0], tone_map, exposure) << 16) |
+				(resolveComponent(c[1], tone_map, exposure) << 8) |
+				resolveComponent(c[2], tone_map, exposure);
+		}
+	}
+}
+
+
+int SDL2Aux::resolveThread(void *data) {
+	threadStarted("SDL2Aux resolve");
+	ResolveHelper *helper = (ResolveHelper *)data;
+	return helper->aux->resolveFrames(helper->band);
+}
+
+
+/*
+* Body of a helper thread: resolves its band whenever
+* resolveHDR() starts a new generation, until the destructor
+* stops it.
+*/
+int SDL2Aux::resolveFrames(int band) {
+	int generation = 0;
+
+	SDL_LockMutex(resolve_mutex);
+	for (;;) {
+		while (resolve_generation == generation && !resolve_quit) {
+			SDL_CondWait(resolve_cond, resolve_mutex);
+		}
+		if (resolve_quit) {
+			break;
+		}
+		generation = resolve_generation;
+		SDL_UnlockMutex(resolve_mutex);
+
+		resolveBand(band);
+
+		SDL_LockMutex(resolve_mutex);
+		if (--resolve_pending == 0) {
+			SDL_CondBroadcast(resolve_cond);
+		}
+	}
+	SDL_UnlockMutex(resolve_mutex);
+
+	return 0;
+}
+
+
+/*
+* Sets how render() uploads frames drawn into a pixel buffer.
+* With SDL2AUX_UPLOAD_CHANGED, each frame is compared tile by
+* tile with the last one uploaded, at the cost of a copy of the
+* frame in memory, and only the tiles that changed are uploaded.
+* That saves bandwidth when little of the image changes between
+* frames. It has no effect with SDL2AUX_LOCK, which has nothing
+* to upload, or headless.
+*/
+void SDL2Aux::setUpload(SDL2AuxUpload upload) {
+	if (present_mutex != NULL) {
+		SDL_LockMutex(present_mutex);
+	}
+	this->upload = upload;
+	if (present_mutex != NULL) {
+		SDL_UnlockMutex(present_mutex);
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef SDL2_IMAGE_WRITER_H
+#define SDL2_IMAGE_WRITER_H
+
+#include <SDL.h>
+#include <vector>
+
+class SDL2Aux;
+
+// File formats of SDL2ImageWriter.
+enum SDL2ImageFormat {
+  SDL2IMAGE_PPM,  // Binary PPM: a short header and raw RGB bytes
+  SDL2IMAGE_QOI   // "Quite OK Image": lossless, compressed in one fast pass
+};
+
+// Writes images on a background thread. write() only copies the frame
+// into a bounded queue; when the queue is full the frame is dropped
+// rather than stalling the caller. Frames are queued from one thread.
+class SDL2ImageWriter {
+  private:
+    struct Image {
+      char filename[256];
+      SDL2ImageFormat format;
+      int width;
+      int height;
+      std::vector<Uint32> pixels;  // 0xAARRGGBB, rows packed
+    };
+
+    // Queued images are images[first] onwards, wrapping around. The
+    // writer thread owns images[first] until it is written.
+    std::vector<Image> images;
+    int first = 0;
+    int queued = 0;
+    int written_count = 0;
+    int dropped_count = 0;
+    bool quit = false;
+    SDL_Thread *thread = NULL;
+    SDL_mutex *mutex = NULL;
+    SDL_cond *cond = NULL;
+
+    std::vector<Uint8> encoded;  // The writer thread's file contents
+
+    const char *capture_pattern = NULL;
+    SDL2ImageFormat capture_format = SDL2IMAGE_QOI;
+    int capture_every = 1;
+    int capture_frame = 0;
+
+  public:
+    ~SDL2ImageWriter();
+    SDL2ImageWriter(int queue_length = 4);
+    bool write(const char *filename, SDL2ImageFormat format,
+      const Uint32 *pixels, int width, int height, int pitch);
+    void capture(SDL2Aux *aux, const char *pattern,
+      SDL2ImageFormat format, int every = 1);
+    void finish();
+    int written();
+    int dropped();
+
+  private:
+    static int writerThread(void *data);
+    int writeImages();
+    static void captureFrame(const Uint32 *pixels, int width, int height,
+      int pitch, void *user_data);
+    void encodePPM(const Image &image);
+    void encodeQOI(const Image &image);
+};
+#endif
@@ -0,0 +1,68 @@
+#ifndef SDL2_VIDEO_WRITER_H
+#define SDL2_VIDEO_WRITER_H
+
+#include <SDL.h>
+#include <cstdio>
+#include <vector>
+
+class SDL2Aux;
+
+// Stream formats of SDL2VideoWriter.
+enum SDL2VideoFormat {
+  SDL2VIDEO_Y4M,  // YUV4MPEG2 with 4:2:0 chroma, playable and encodable as is
+  SDL2VIDEO_RGBA  // Raw RGBA bytes, frame after frame, e.g. to pipe into an encoder
+};
+
+// Streams frames to a video file (or standard output) from a worker
+// thread, which converts them to the stream format and writes each frame
+// with a single unbuffered write. write() only copies the frame into a
+// bounded queue, and waits when the queue is full, so no frame is lost.
+// Frames are queued from one thread and all have the size of the first.
+class SDL2VideoWriter {
+  private:
+    struct Frame {
+      std::vector<Uint32> pixels;  // 0xAARRGGBB, rows packed
+    };
+
+    // Queued frames are frames[first] onwards, wrapping around. The
+    // worker thread owns frames[first] until it is written.
+    std::vector<Frame> frames;
+    int first = 0;
+    int queued = 0;
+    int written_count = 0;
+    bool quit = false;
+    SDL_Thread *thread = NULL;
+    SDL_mutex *mutex = NULL;
+    SDL_cond *cond = NULL;
+
+    FILE *file = NULL;
+    SDL2VideoFormat format;
+    int fps;
+    int width = 0;
+    int height = 0;
+
+    // The worker thread's output: one frame in the stream format,
+    // aligned for the write.
+    std::vector<Uint8> output_storage;
+    Uint8 *output = NULL;
+    size_t output_size = 0;
+
+  public:
+    ~SDL2VideoWriter();
+    SDL2VideoWriter(const char *filename, SDL2VideoFormat format,
+      int fps = 30, int queue_length = 3);
+    bool isOpen();
+    void write(const Uint32 *pixels, int width, int height, int pitch);
+    void capture(SDL2Aux *aux);
+    void finish();
+    int written();
+
+  private:
+    static int writerThread(void *data);
+    int writeFrames();
+    static void captureFrame(const Uint32 *pixels, int width, int height,
+      int pitch, void *user_data);
+    void convertY4M(const Uint32 *pixels);
+    void convertRGBA(const Uint32 *pixels);
+};
+#endif
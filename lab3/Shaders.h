@@ -0,0 +1,212 @@
+#ifndef SHADERS_H
+#define SHADERS_H
+
+// Vertex and pixel shader functors for the templated pipeline in
+// Pipeline.h. Uniforms live in the functors and per-triangle state is
+// picked up in BeginTriangle(), so nothing is passed through globals.
+// Pixel shaders receive 2x2 quads and only write the lanes in quad.mask.
+
+#include <glm/glm.hpp>
+#include "SDL2Auxiliary.h"
+#include "Msaa.h"
+#include "Pipeline.h"
+#include "ShadowMap.h"
+#include "Texture.h"
+
+// ----------------------------------------------------------------------------
+// VERTEX SHADERS
+
+// Projects positions only (Tasks 5 and 6).
+struct FlatVertexShader
+{
+	typedef Varyings<0> Out;
+
+	void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index, ClipVertex<Out>& out ) const
+	{
+		out.view = camera.ToView(mesh.positions[index]);
+	}
+};
+
+// Passes the texture coordinates on (deferred geometry pass).
+struct TexCoordVertexShader
+{
+	typedef Varyings<2> Out;
+
+	void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index, ClipVertex<Out>& out ) const
+	{
+		out.view = camera.ToView(mesh.positions[index]);
+		out.varyings.v[0] = mesh.uvs[index].x;
+		out.varyings.v[1] = mesh.uvs[index].y;
+	}
+};
+
+// Also passes the world position on for per-pixel lighting (Task 7),
+// followed by the texture coordinates.
+struct WorldPositionVertexShader
+{
+	typedef Varyings<5> Out;
+
+	void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index, ClipVertex<Out>& out ) const
+	{
+		const glm::vec3& position = mesh.positions[index];
+		out.view = camera.ToView(position);
+		out.varyings.SetVec3(0, position);
+		out.varyings.v[3] = mesh.uvs[index].x;
+		out.varyings.v[4] = mesh.uvs[index].y;
+	}
+};
+
+// WorldPositionVertexShader for untextured triangles: the world position
+// only, so no texture coordinates are interpolated.
+struct UntexturedVertexShader
+{
+	typedef Varyings<3> Out;
+
+	void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index, ClipVertex<Out>& out ) const
+	{
+		const glm::vec3& position = mesh.positions[index];
+		out.view = camera.ToView(position);
+		out.varyings.SetVec3(0, position);
+	}
+};
+
+// ----------------------------------------------------------------------------
+// PIXEL SHADERS
+
+// Where the forward pixel shaders write: straight to the screen, or to the
+// samples of an MSAA buffer that the raster loop let through. The raster
+// loop keeps quad.mask inside the target, so screen writes are spans
+// without per-pixel bounds checks, both lanes of a quad row at once when
+// they are both active.
+struct ColorOutput
+{
+	SDL2Aux* screen;
+	MsaaBuffer* msaa;
+
+	template<typename VaryingsT>
+	void Write( const Quad<VaryingsT>& quad, const glm::vec3 colors[4] ) const
+	{
+		if (msaa != NULL)
+		{
+			for (int k = 0; k < 4; ++k)
+			{
+				if (quad.Active(k))
+					msaa->Write(quad.X(k), quad.Y(k), quad.samples[k], colors[k]);
+			}
+			return;
+		}
+
+		for (int row = 0; row < 2; ++row)
+		{
+			int lanes = (quad.mask >> (2 * row)) & 3;
+			if (lanes == 3)
+				screen->putSpan(quad.x, quad.y + row, 2, &colors[2 * row]);
+			else if (lanes != 0)
+				screen->putSpan(quad.x + (lanes >> 1), quad.y + row, 1, &colors[2 * row + (lanes >> 1)]);
+		}
+	}
+};
+
+// Writes the triangle color unlit (Tasks 5 and 6).
+struct FlatColorShader
+{
+	ColorOutput output;
+	glm::vec3 color;
+
+	explicit FlatColorShader( const ColorOutput& output ) : output(output) {}
+
+	void BeginTriangle( const IndexedMesh& mesh, int triangle )
+	{
+		color = mesh.colors[triangle];
+	}
+
+	void operator()( const Quad<FlatVertexShader::Out>& quad )
+	{
+		const glm::vec3 colors[4] = { color, color, color, color };
+		output.Write(quad, colors);
+	}
+};
+
+// Diffuse point light plus constant indirect light, evaluated per pixel
+// from the interpolated world position (Task 7). Direct light is scaled by
+// the shadow map visibility when one is given. Textured triangles modulate
+// their color with the texture; untextured ones can be drawn with
+// UntexturedVertexShader instead. The lighting runs on all four lanes of a
+// quad at once.
+struct PointLightShader
+{
+	ColorOutput output;
+	glm::vec3 lightPos;
+	glm::vec3 lightPower;
+	glm::vec3 indirectLight;
+	const CubeShadowMap* shadowMap;
+	const std::vector<Texture>* textures;
+
+	glm::vec3 normal;
+	glm::vec3 reflectance;
+	const Texture* texture;
+
+	PointLightShader( const ColorOutput& output, glm::vec3 lightPos, glm::vec3 lightPower, glm::vec3 indirectLight,
+		const CubeShadowMap* shadowMap = NULL, const std::vector<Texture>* textures = NULL )
+		: output(output), lightPos(lightPos), lightPower(lightPower), indirectLight(indirectLight),
+		shadowMap(shadowMap), textures(textures)
+	{
+	}
+
+	void BeginTriangle( const IndexedMesh& mesh, int triangle )
+	{
+		normal = mesh.normals[triangle];
+		reflectance = mesh.colors[triangle];
+		int id = mesh.textures[triangle];
+		texture = textures != NULL && id >= 0 ? &(*textures)[id] : NULL;
+	}
+
+	void operator()( const Quad<UntexturedVertexShader::Out>& quad )
+	{
+		Shade(quad, Vec3x4::Set1(reflectance));
+	}
+
+	void operator()( const Quad<WorldPositionVertexShader::Out>& quad )
+	{
+		Vec3x4 rho = Vec3x4::Set1(reflectance);
+		if (texture != NULL)
+			rho = rho * texture->SampleQuad(quad.v[3], quad.v[4]);
+		Shade(quad, rho);
+	}
+
+private:
+	// Lights the world positions in the first three varyings and writes
+	// them with reflectance rho.
+	template<typename VaryingsT>
+	void Shade( const Quad<VaryingsT>& quad, const Vec3x4& rho )
+	{
+		Vec3x4 position = quad.Vec3(0);
+		Vec3x4 r = Vec3x4::Set1(lightPos) - position;
+		Float4 r2 = Dot(r, r);
+		Float4 cosine = Max(Dot(Normalize(r), Vec3x4::Set1(normal)), Float4::Set1(0.0f));
+		if (shadowMap != NULL)
+		{
+			float visibility[4];
+			cosine.Store(visibility);
+			for (int k = 0; k < 4; ++k)
+			{
+				if (quad.Active(k) && visibility[k] > 0.0f)
+					visibility[k] = shadowMap->Visibility(position.Lane(k), normal);
+			}
+			cosine = cosine * Float4::Load(visibility);
+		}
+		Float4 scale = cosine / (Float4::Set1(4.0f * 3.14159265359f) * r2);
+		Vec3x4 color = rho * (Vec3x4::Set1(lightPower) * scale + Vec3x4::Set1(indirectLight));
+
+		float red[4], green[4], blue[4];
+		color.x.Store(red);
+		color.y.Store(green);
+		color.z.Store(blue);
+		glm::vec3 colors[4];
+		for (int k = 0; k < 4; ++k)
+			colors[k] = glm::vec3(red[k], green[k], blue[k]);
+		output.Write(quad, colors);
+	}
+};
+
+#endif
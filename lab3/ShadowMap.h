@@ -0,0 +1,152 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+// Omnidirectional shadow map for the point light: six 90 degree depth
+// images rendered from the light with the regular raster pipeline. The
+// faces are only re-rendered when the light moves or the geometry changes,
+// so a static scene pays for shadows with the lookups alone.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+
+// Relative, keeps a receiver from failing the depth comparison against
+// the face texels its own surface was rendered into.
+const float SHADOW_DEPTH_BIAS = 0.01f;
+
+class CubeShadowMap
+{
+public:
+	explicit CubeShadowMap( int resolution )
+		: resolution(resolution), valid(false), renderedVersion(-1), renders(0)
+	{
+		for (int f = 0; f < FACES; ++f)
+			depth[f].resize(resolution * resolution);
+
+		// Right, down and forward axis of each face camera.
+		using glm::vec3;
+		basis[0] = glm::mat3(vec3(0, 0, -1), vec3(0, 1, 0), vec3(1, 0, 0));
+		basis[1] = glm::mat3(vec3(0, 0, 1), vec3(0, 1, 0), vec3(-1, 0, 0));
+		basis[2] = glm::mat3(vec3(1, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+		basis[3] = glm::mat3(vec3(1, 0, 0), vec3(0, 0, 1), vec3(0, -1, 0));
+		basis[4] = glm::mat3(vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1));
+		basis[5] = glm::mat3(vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, 0, -1));
+	}
+
+	// Re-renders all faces if the light position or the geometry version
+	// differs from the last render. Returns true if it rendered. lodLevels
+	// as for DrawIndexedMesh().
+	bool Update( const IndexedMesh& mesh, int geometryVersion, const glm::vec3& lightPos,
+		const int* lodLevels = NULL )
+	{
+		if (valid && geometryVersion == renderedVersion && lightPos == renderedLightPos)
+			return false;
+
+		for (int f = 0; f < FACES; ++f)
+		{
+			std::fill(depth[f].begin(), depth[f].end(), 0.0f);
+			RenderTarget target = { resolution, resolution, &depth[f][0], NULL, NULL };
+			Camera camera = FaceCamera(f, lightPos);
+			DepthVertexShader vs;
+			DepthPixelShader ps;
+			DrawSelection selection = { NULL, lodLevels, false, NULL };
+			DrawIndexedMesh(mesh, camera, vs, ps, target, selection);
+		}
+
+		valid = true;
+		renderedVersion = geometryVersion;
+		renderedLightPos = lightPos;
+		++renders;
+		return true;
+	}
+
+	// Fraction of the light reaching a surface point with the given normal,
+	// filtered over 3x3 shadow texels (percentage closer filtering).
+	float Visibility( const glm::vec3& position, const glm::vec3& normal ) const
+	{
+		glm::vec3 toPoint = position - renderedLightPos;
+		int f = MajorFace(toPoint);
+		float distance = glm::abs(toPoint[f / 2]);
+
+		// Push the lookup along the normal by about a texel's footprint at
+		// this distance to keep surfaces from shadowing themselves.
+		float texel = 2.0f * distance / resolution;
+		glm::vec3 view = (toPoint + normal * (1.5f * texel)) * basis[f];
+		if (view.z <= NEAR_PLANE)
+			return 1.0f;
+
+		float focal = 0.5f * resolution;
+		int x = int(focal * view.x / view.z + resolution / 2);
+		int y = int(focal * view.y / view.z + resolution / 2);
+		float receiver = view.z * (1.0f - SHADOW_DEPTH_BIAS);
+
+		const float* face = &depth[f][0];
+		int lit = 0;
+		for (int dy = -1; dy <= 1; ++dy)
+		{
+			int sy = std::min(std::max(y + dy, 0), resolution - 1);
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				int sx = std::min(std::max(x + dx, 0), resolution - 1);
+				// Stored as 1/z: the receiver is lit if nothing nearer was
+				// rasterized, i.e. the stored 1/z is not larger.
+				if (face[sy * resolution + sx] * receiver <= 1.0f)
+					++lit;
+			}
+		}
+		return lit / 9.0f;
+	}
+
+	// Number of times the faces have been rendered, for profiling.
+	int RenderCount() const { return renders; }
+
+private:
+	static const int FACES = 6;
+
+	// Depth-only shaders: the pipeline writes 1/z, nothing else to do.
+	struct DepthVertexShader
+	{
+		typedef Varyings<0> Out;
+
+		void operator()( const Camera& camera, const IndexedMesh& mesh, uint32_t index, ClipVertex<Out>& out ) const
+		{
+			out.view = camera.ToView(mesh.positions[index]);
+		}
+	};
+
+	struct DepthPixelShader
+	{
+		void BeginTriangle( const IndexedMesh&, int ) {}
+		void operator()( const Quad<Varyings<0> >& ) {}
+	};
+
+	int resolution;
+	std::vector<float> depth[FACES];
+	glm::mat3 basis[FACES];
+	bool valid;
+	int renderedVersion;
+	glm::vec3 renderedLightPos;
+	int renders;
+
+	Camera FaceCamera( int f, const glm::vec3& lightPos ) const
+	{
+		Camera camera = { lightPos, basis[f], 0.5f * resolution, resolution, resolution };
+		return camera;
+	}
+
+	// Face whose forward axis is the dominant component of d, in the
+	// order +x, -x, +y, -y, +z, -z.
+	static int MajorFace( const glm::vec3& d )
+	{
+		glm::vec3 a = glm::abs(d);
+		if (a.x >= a.y && a.x >= a.z)
+			return d.x >= 0 ? 0 : 1;
+		if (a.y >= a.z)
+			return d.y >= 0 ? 2 : 3;
+		return d.z >= 0 ? 4 : 5;
+	}
+};
+
+#endif
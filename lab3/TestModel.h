@@ -5,6 +5,22 @@
 
 #include <glm/glm.hpp>
 #include <vector>
+#include "Texture.h"
+
+// Textures of the test model, as created by LoadTestTextures().
+enum TestTexture
+{
+	TEXTURE_CHECKER = 0,
+	TEXTURE_BRICK = 1
+};
+
+// Parts of the test model, drawn and culled as separate objects.
+enum TestObject
+{
+	OBJECT_ROOM = 0,
+	OBJECT_SHORT_BLOCK = 1,
+	OBJECT_TALL_BLOCK = 2
+};
 
 // Used to describe a triangular surface:
 class Triangle
@@ -15,9 +31,14 @@ public:
 	glm::vec3 v2;
 	glm::vec3 normal;
 	glm::vec3 color;
-
-	Triangle( glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 color )
-		: v0(v0), v1(v1), v2(v2), color(color)
+	glm::vec2 uv0;		// Texture coordinates, in repeats of the texture
+	glm::vec2 uv1;
+	glm::vec2 uv2;
+	int texture;		// TestTexture modulating color, -1 for none
+	int object;			// TestObject it belongs to
+
+	Triangle( glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 color, int texture = -1 )
+		: v0(v0), v1(v1), v2(v2), color(color), texture(texture), object(OBJECT_ROOM)
 	{
 		ComputeNormal();
 	}
@@ -28,6 +49,27 @@ public:
 		glm::vec3 e2 = v2-v0;
 		normal = glm::normalize( glm::cross( e2, e1 ) );
 	}
+
+	// Box mapping: projects the vertices onto the axis plane the triangle
+	// faces most.
+	void ComputeTextureCoordinates( float repeatsPerUnit )
+	{
+		glm::vec3 a = glm::abs(normal);
+		int i = 0, j = 1;
+		if (a.x >= a.y && a.x >= a.z)
+			i = 2;
+		else if (a.y >= a.z)
+			j = 2;
+		uv0 = glm::vec2(v0[i], v0[j]) * repeatsPerUnit;
+		uv1 = glm::vec2(v1[i], v1[j]) * repeatsPerUnit;
+		uv2 = glm::vec2(v2[i], v2[j]) * repeatsPerUnit;
+	}
+
+	// Texture coordinates at v0 + u * (v1 - v0) + v * (v2 - v0).
+	glm::vec2 TexCoord( float u, float v ) const
+	{
+		return uv0 + u * (uv1 - uv0) + v * (uv2 - uv0);
+	}
 };
 
 // Loads the Cornell Box. It is scaled to fill the volume:
@@ -66,8 +108,8 @@ void LoadTestModel( std::vector<Triangle>& triangles )
 	vec3 H(0,L,L);
 
 	// Floor:
-	triangles.push_back( Triangle( C, B, A, green ) );
-	triangles.push_back( Triangle( C, D, B, green ) );
+	triangles.push_back( Triangle( C, B, A, green, TEXTURE_CHECKER ) );
+	triangles.push_back( Triangle( C, D, B, green, TEXTURE_CHECKER ) );
 
 	// Left wall
 	triangles.push_back( Triangle( A, E, C, purple ) );
@@ -82,12 +124,14 @@ void LoadTestModel( std::vector<Triangle>& triangles )
 	triangles.push_back( Triangle( F, H, G, cyan ) );
 
 	// Back wall
-	triangles.push_back( Triangle( G, D, C, white ) );
-	triangles.push_back( Triangle( G, H, D, white ) );
+	triangles.push_back( Triangle( G, D, C, white, TEXTURE_BRICK ) );
+	triangles.push_back( Triangle( G, H, D, white, TEXTURE_BRICK ) );
 
 	// ---------------------------------------------------------------------------
 	// Short block
 
+	size_t shortBlock = triangles.size();
+
 	A = vec3(290,0,114);
 	B = vec3(130,0, 65);
 	C = vec3(240,0,272);
@@ -121,6 +165,8 @@ void LoadTestModel( std::vector<Triangle>& triangles )
 	// ---------------------------------------------------------------------------
 	// Tall block
 
+	size_t tallBlock = triangles.size();
+
 	A = vec3(423,0,247);
 	B = vec3(265,0,296);
 	C = vec3(472,0,406);
@@ -174,7 +220,56 @@ void LoadTestModel( std::vector<Triangle>& triangles )
 		triangles[i].v2.y *= -1;
 
 		triangles[i].ComputeNormal();
+		triangles[i].ComputeTextureCoordinates(2.0f);
+
+		if( i >= tallBlock )
+			triangles[i].object = OBJECT_TALL_BLOCK;
+		else if( i >= shortBlock )
+			triangles[i].object = OBJECT_SHORT_BLOCK;
+	}
+}
+
+// Creates the procedural textures referenced by TestTexture. Texel values
+// modulate the triangle colors.
+void LoadTestTextures( std::vector<Texture>& textures )
+{
+	using glm::vec3;
+
+	const int size = 256;
+	textures.clear();
+	textures.push_back( Texture(size) );
+	textures.push_back( Texture(size) );
+
+	// Checker: 2x2 squares per repeat.
+	Texture& checker = textures[TEXTURE_CHECKER];
+	for( int y=0; y<size; ++y )
+		for( int x=0; x<size; ++x )
+			checker.SetTexel( x, y, vec3( ((x ^ y) & (size/2)) ? 0.6f : 1.0f ) );
+
+	// Bricks: 4 courses of 2 bricks per repeat, every other course offset
+	// by half a brick, with a little variation between bricks.
+	Texture& brick = textures[TEXTURE_BRICK];
+	const int course = size/4;
+	const int mortar = size/64;
+	for( int y=0; y<size; ++y )
+	{
+		int row = y / course;
+		for( int x=0; x<size; ++x )
+		{
+			int bx = (x + (row & 1) * course) % size;
+			int column = bx / (2*course);
+			if( y % course < mortar || bx % (2*course) < mortar )
+			{
+				brick.SetTexel( x, y, vec3(0.55f) );
+				continue;
+			}
+			float shade = 1.0f - 0.05f * ((row * 7 + column * 3) % 4);
+			brick.SetTexel( x, y, vec3(shade, 0.9f * shade, 0.85f * shade) );
+		}
 	}
+
+	for( size_t i=0; i<textures.size(); ++i )
+		textures[i].BuildMipmaps();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+// Mip-mapped textures with 8-bit RGB texels. Every level is stored in
+// Morton (Z) order, so the four texels of a bilinear footprint and the
+// footprints of neighbouring pixels stay close in memory however the
+// texture is oriented on screen. Addressing wraps; texture coordinates are
+// in repeats of the texture.
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+#include "Simd.h"
+
+class Texture
+{
+public:
+	// size must be a power of two (at most 1 << 15). Starts out black.
+	explicit Texture( int size )
+		: size(size), levels(0)
+	{
+		int texelCount = 0;
+		for (int s = size; s >= 1; s /= 2)
+		{
+			offsets[levels++] = texelCount;
+			texelCount += s * s;
+		}
+		texels.resize(texelCount);
+	}
+
+	int Size() const { return size; }
+	int Levels() const { return levels; }
+
+	// Writes a texel of the full resolution level.
+	void SetTexel( int x, int y, const glm::vec3& color )
+	{
+		texels[Morton(x, y)] = Pack(color);
+	}
+
+	// Box filters each level from the one above. In Morton order the four
+	// texels covered by texel i of the next level are 4i to 4i + 3.
+	void BuildMipmaps()
+	{
+		for (int l = 1; l < levels; ++l)
+		{
+			const uint32_t* parent = &texels[offsets[l - 1]];
+			uint32_t* level = &texels[offsets[l]];
+			int count = (size >> l) * (size >> l);
+			for (int i = 0; i < count; ++i)
+			{
+				glm::vec3 sum(0.0f);
+				for (int c = 0; c < 4; ++c)
+					sum += Unpack(parent[4 * i + c]);
+				level[i] = Pack(0.25f * sum);
+			}
+		}
+	}
+
+	// Level of detail for the texture coordinate derivatives along screen
+	// x and y: log2 of the texels stepped per pixel.
+	float Lod( const glm::vec2& dx, const glm::vec2& dy ) const
+	{
+		float rho2 = std::max(glm::dot(dx, dx), glm::dot(dy, dy)) * float(size) * float(size);
+		return 0.5f * std::log2(std::max(rho2, 1e-12f));
+	}
+
+	// Trilinear sample.
+	glm::vec3 Sample( const glm::vec2& uv, float lod ) const
+	{
+		lod = glm::clamp(lod, 0.0f, float(levels - 1));
+		int level = int(lod);
+		float t = lod - level;
+		glm::vec3 a = Bilinear(level, uv);
+		if (t == 0.0f)
+			return a;
+		return a + (Bilinear(level + 1, uv) - a) * t;
+	}
+
+	// Trilinear samples at four coordinates sharing a level of detail,
+	// e.g. the pixels of a quad.
+	Vec3x4 Sample( Float4 u, Float4 v, float lod ) const
+	{
+		lod = glm::clamp(lod, 0.0f, float(levels - 1));
+		int level = int(lod);
+		float t = lod - level;
+		Vec3x4 a = Bilinear(level, u, v);
+		if (t == 0.0f)
+			return a;
+		return a + (Bilinear(level + 1, u, v) - a) * Float4::Set1(t);
+	}
+
+	// Samples a 2x2 pixel quad (lanes 0 and 1 on the top row), taking the
+	// level of detail from the coordinate differences between its lanes.
+	Vec3x4 SampleQuad( Float4 u, Float4 v ) const
+	{
+		glm::vec2 dx(u[1] - u[0], v[1] - v[0]);
+		glm::vec2 dy(u[2] - u[0], v[2] - v[0]);
+		return Sample(u, v, Lod(dx, dy));
+	}
+
+private:
+	static const int MAX_LEVELS = 16;
+
+	int size;
+	int levels;
+	int offsets[MAX_LEVELS];		// First texel of each level
+	std::vector<uint32_t> texels;	// 0x00RRGGBB
+
+	// Spreads the low 16 bits of x to the even bits.
+	static uint32_t Part1By1( uint32_t x )
+	{
+		x = (x | (x << 8)) & 0x00ff00ff;
+		x = (x | (x << 4)) & 0x0f0f0f0f;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+
+	static Int4 Part1By1( Int4 x )
+	{
+		x = (x | (x << 8)) & Int4::Set1(0x00ff00ff);
+		x = (x | (x << 4)) & Int4::Set1(0x0f0f0f0f);
+		x = (x | (x << 2)) & Int4::Set1(0x33333333);
+		x = (x | (x << 1)) & Int4::Set1(0x55555555);
+		return x;
+	}
+
+	static uint32_t Morton( int x, int y )
+	{
+		return Part1By1(x) | (Part1By1(y) << 1);
+	}
+
+	static uint32_t Pack( const glm::vec3& c )
+	{
+		uint32_t r = uint32_t(glm::clamp(c.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+		uint32_t g = uint32_t(glm::clamp(c.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+		uint32_t b = uint32_t(glm::clamp(c.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+		return (r << 16) | (g << 8) | b;
+	}
+
+	static glm::vec3 Unpack( uint32_t t )
+	{
+		return glm::vec3((t >> 16) & 0xff, (t >> 8) & 0xff, t & 0xff) / 255.0f;
+	}
+
+	static Vec3x4 Unpack( Int4 t )
+	{
+		Int4 byte = Int4::Set1(0xff);
+		Float4 scale = Float4::Set1(1.0f / 255.0f);
+		return Vec3x4(ToFloat((t >> 16) & byte) * scale, ToFloat((t >> 8) & byte) * scale,
+			ToFloat(t & byte) * scale);
+	}
+
+	glm::vec3 Bilinear( int level, const glm::vec2& uv ) const
+	{
+		int s = size >> level;
+		float x = uv.x * s - 0.5f;
+		float y = uv.y * s - 0.5f;
+		float fx = std::floor(x);
+		float fy = std::floor(y);
+		int x0 = int(fx) & (s - 1);
+		int y0 = int(fy) & (s - 1);
+		int x1 = (x0 + 1) & (s - 1);
+		int y1 = (y0 + 1) & (s - 1);
+
+		const uint32_t* t = &texels[offsets[level]];
+		glm::vec3 top = glm::mix(Unpack(t[Morton(x0, y0)]), Unpack(t[Morton(x1, y0)]), x - fx);
+		glm::vec3 bottom = glm::mix(Unpack(t[Morton(x0, y1)]), Unpack(t[Morton(x1, y1)]), x - fx);
+		return glm::mix(top, bottom, y - fy);
+	}
+
+	// Texel addresses and weights are computed for all four lanes at once;
+	// only the texel loads themselves are scalar.
+	Vec3x4 Bilinear( int level, Float4 u, Float4 v ) const
+	{
+		int s = size >> level;
+		Float4 half = Float4::Set1(0.5f);
+		Float4 x = u * Float4::Set1(float(s)) - half;
+		Float4 y = v * Float4::Set1(float(s)) - half;
+		Int4 ix = FloorToInt(x);
+		Int4 iy = FloorToInt(y);
+		Float4 wx = x - ToFloat(ix);
+		Float4 wy = y - ToFloat(iy);
+
+		Int4 wrap = Int4::Set1(s - 1);
+		Int4 one = Int4::Set1(1);
+		Int4 mx0 = Part1By1(ix & wrap);
+		Int4 mx1 = Part1By1((ix + one) & wrap);
+		Int4 my0 = Part1By1(iy & wrap) << 1;
+		Int4 my1 = Part1By1((iy + one) & wrap) << 1;
+		Int4 corners[4] = { mx0 | my0, mx1 | my0, mx0 | my1, mx1 | my1 };
+
+		const uint32_t* t = &texels[offsets[level]];
+		Vec3x4 c[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			int index[4];
+			int gathered[4];
+			corners[i].Store(index);
+			for (int k = 0; k < 4; ++k)
+				gathered[k] = int(t[index[k]]);
+			c[i] = Unpack(Int4::Load(gathered));
+		}
+
+		Vec3x4 top = c[0] + (c[1] - c[0]) * wx;
+		Vec3x4 bottom = c[2] + (c[3] - c[2]) * wx;
+		return top + (bottom - top) * wy;
+	}
+};
+
+#endif
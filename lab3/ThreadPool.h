@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Persistent worker threads for data-parallel passes. ParallelFor() hands
+// out indices through an atomic counter and the calling thread works too.
+// Jobs are passed as a function pointer plus context rather than a
+// std::function, so dispatching never allocates.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// threads is the total number of threads working on a job including the
+	// caller; 0 picks one per hardware thread.
+	explicit ThreadPool( int threads = 0 )
+		: generation(0), pending(0), quit(false), invoke(NULL), context(NULL), count(0)
+	{
+		if (threads <= 0)
+			threads = std::max(1, int(std::thread::hardware_concurrency()));
+		for (int i = 1; i < threads; ++i)
+			workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+	}
+
+	int ThreadCount() const { return int(workers.size()) + 1; }
+
+	// Calls f(i) for every i in [0, count) across all threads and returns
+	// when all calls have finished. Not reentrant.
+	template<typename F>
+	void ParallelFor( int count, const F& f )
+	{
+		if (count <= 0)
+			return;
+		if (workers.empty() || count == 1)
+		{
+			for (int i = 0; i < count; ++i)
+				f(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->invoke = &Invoke<F>;
+			this->context = &f;
+			this->count = count;
+			next.store(0);
+			pending = int(workers.size());
+			++generation;
+		}
+		wake.notify_all();
+
+		RunJob();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return pending == 0; });
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned generation;
+	int pending;		// Workers that have not finished the current job
+	bool quit;
+
+	void (*invoke)( const void* context, int index );
+	const void* context;
+	int count;
+	std::atomic<int> next;
+
+	template<typename F>
+	static void Invoke( const void* context, int index )
+	{
+		(*static_cast<const F*>(context))(index);
+	}
+
+	void RunJob()
+	{
+		for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+			invoke(context, i);
+	}
+
+	void WorkerLoop()
+	{
+		unsigned seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return quit || generation != seen; });
+				if (quit)
+					return;
+				seen = generation;
+			}
+
+			RunJob();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--pending == 0)
+				done.notify_one();
+		}
+	}
+
+	ThreadPool( const ThreadPool& );
+	ThreadPool& operator=( const ThreadPool& );
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef TILE_CLEAR_H
+#define TILE_CLEAR_H
+
+// Fast clear for per-pixel buffers. The buffer is split into tiles that
+// remember the frame generation they were last cleared in; Clear() only
+// starts a new generation. A tile is cleared when the raster loop first
+// touches it after that, and the passes reading the buffer treat tiles
+// from older generations as empty without looking at them. Clearing costs
+// O(tiles) instead of a pass over every pixel, and a tile nobody draws to
+// is never written at all.
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+// Tiles are CLEAR_TILE_SIZE pixels square, a multiple of the raster
+// loop's 2x2 quads so each quad lies in a single tile.
+const int CLEAR_TILE_SHIFT = 4;
+const int CLEAR_TILE_SIZE = 1 << CLEAR_TILE_SHIFT;
+
+class TileClear
+{
+public:
+	TileClear( int width, int height )
+		: width(width), height(height),
+		tilesX((width + CLEAR_TILE_SIZE - 1) >> CLEAR_TILE_SHIFT),
+		tilesY((height + CLEAR_TILE_SIZE - 1) >> CLEAR_TILE_SHIFT),
+		tags(tilesX * tilesY, 0), generation(1)
+	{
+	}
+
+	// Every tile reads as empty from now on.
+	void Clear()
+	{
+		// Tags only need to differ from the current generation, but not
+		// for an old value to come around again after wrapping.
+		if (++generation == 0)
+		{
+			std::fill(tags.begin(), tags.end(), 0u);
+			generation = 1;
+		}
+	}
+
+	int TileCount() const { return tilesX * tilesY; }
+	int TilesX() const { return tilesX; }
+	int TileAt( int x, int y ) const { return (y >> CLEAR_TILE_SHIFT) * tilesX + (x >> CLEAR_TILE_SHIFT); }
+
+	// True if the tile was touched since the last Clear(); otherwise its
+	// pixels hold stale data and read as empty.
+	bool Current( int tile ) const { return tags[tile] == generation; }
+
+	// Pixel bounds [x0, x1) x [y0, y1) of a tile.
+	void Bounds( int tile, int& x0, int& y0, int& x1, int& y1 ) const
+	{
+		x0 = (tile % tilesX) << CLEAR_TILE_SHIFT;
+		y0 = (tile / tilesX) << CLEAR_TILE_SHIFT;
+		x1 = std::min(x0 + CLEAR_TILE_SIZE, width);
+		y1 = std::min(y0 + CLEAR_TILE_SIZE, height);
+	}
+
+	// Called before pixel (x, y) of a buffer with one float per pixel is
+	// written: clears the pixel's tile to value if this is the first touch
+	// since Clear().
+	void Touch( int x, int y, float* buffer, float value = 0.0f )
+	{
+		int tile = TileAt(x, y);
+		if (Claim(tile))
+			Fill(tile, buffer, value);
+	}
+
+	// Marks a tile as touched. Returns true if this is the first touch
+	// since Clear(), so the caller has to clear the tile's pixels, e.g.
+	// with Fill() for each of several buffers.
+	bool Claim( int tile )
+	{
+		if (tags[tile] == generation)
+			return false;
+		tags[tile] = generation;
+		return true;
+	}
+
+	// Sets a tile's pixels of a buffer with one T per pixel to value.
+	template<typename T>
+	void Fill( int tile, T* buffer, const T& value ) const
+	{
+		int x0, y0, x1, y1;
+		Bounds(tile, x0, y0, x1, y1);
+		for (int row = y0; row < y1; ++row)
+			std::fill(buffer + row * width + x0, buffer + row * width + x1, value);
+	}
+
+private:
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+	std::vector<uint32_t> tags;		// Generation each tile was last cleared in
+	uint32_t generation;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef VISIBILITY_BUFFER_H
+#define VISIBILITY_BUFFER_H
+
+// Visibility buffer rendering. The raster pass writes only 1/z and the
+// index of the visible triangle, 8 bytes per fragment, and interpolates
+// no varyings. The shading pass then intersects each pixel's camera ray
+// with its triangle to recover the barycentrics, rebuilds the attributes
+// from the mesh and lights the pixel once. Shading cost therefore follows
+// the number of pixels, not how often triangles overlap them. Tiles are
+// shaded in parallel, with shadows from the cube shadow map or from shadow
+// rays traced against a RayScene (the hybrid mode).
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+#include "SDL2Auxiliary.h"
+#include "IndexedMesh.h"
+#include "Pipeline.h"
+#include "RayTracer.h"
+#include "ShadowMap.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "TileClear.h"
+
+class VisibilityBuffer
+{
+public:
+	VisibilityBuffer( int width, int height )
+		: width(width), height(height),
+		depth(width * height), triangles(width * height), tiles(width, height)
+	{
+	}
+
+	// Only depth needs clearing, and only tile by tile as it is drawn to;
+	// triangles are read where 1/z > 0.
+	void Clear()
+	{
+		tiles.Clear();
+	}
+
+	RenderTarget Target()
+	{
+		RenderTarget target = { width, height, &depth[0], NULL, &tiles };
+		return target;
+	}
+
+	int width;
+	int height;
+	std::vector<float> depth;			// 1/z, 0 where nothing was drawn
+	std::vector<uint32_t> triangles;	// Mesh triangle index, unique across objects
+	TileClear tiles;					// Depth is stale in tiles not Current()
+};
+
+// Pixel shader for the visibility pass: stores the triangle index. Any
+// vertex shader without varyings goes with it.
+struct VisibilityShader
+{
+	VisibilityBuffer* buffer;
+	uint32_t triangle;
+
+	explicit VisibilityShader( VisibilityBuffer* buffer ) : buffer(buffer) {}
+
+	void BeginTriangle( const IndexedMesh&, int triangle )
+	{
+		this->triangle = triangle;
+	}
+
+	void operator()( const Quad<Varyings<0> >& quad )
+	{
+		for (int k = 0; k < 4; ++k)
+		{
+			if (quad.Active(k))
+				buffer->triangles[quad.Y(k) * buffer->width + quad.X(k)] = triangle;
+		}
+	}
+};
+
+// Surface attributes reconstructed for one pixel.
+struct VisibleSurface
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 reflectance;
+};
+
+// Reconstructs the surface seen in pixel (x, y) of a Current() tile; false
+// if there is none.
+// The barycentrics are where the ray through the pixel center meets the
+// triangle's plane. Textures are filtered at the mip level given by ray
+// differentials: the texture coordinates where the rays through the
+// neighbouring pixels meet the plane, as in Lab 2.
+inline bool FetchSurface( const VisibilityBuffer& buffer, const IndexedMesh& mesh, const Camera& camera,
+	const std::vector<Texture>* textures, int x, int y, VisibleSurface& surface )
+{
+	int i = y * buffer.width + x;
+	if (buffer.depth[i] <= 0)
+		return false;
+
+	int triangle = int(buffer.triangles[i]);
+	const uint32_t* corners = &mesh.indices[3 * triangle];
+	const glm::vec3& v0 = mesh.positions[corners[0]];
+	glm::vec3 e1 = mesh.positions[corners[1]] - v0;
+	glm::vec3 e2 = mesh.positions[corners[2]] - v0;
+	glm::vec3 hit = SolveRay(v0, e1, e2, camera.position, camera.RayDirection(x + 0.5f, y + 0.5f));
+	float u = hit.y;
+	float v = hit.z;
+	surface.position = v0 + u * e1 + v * e2;
+	surface.normal = mesh.normals[triangle];
+	surface.reflectance = mesh.colors[triangle];
+
+	int id = mesh.textures[triangle];
+	if (textures == NULL || id < 0)
+		return true;
+
+	const glm::vec2& uv0 = mesh.uvs[corners[0]];
+	glm::vec2 du = mesh.uvs[corners[1]] - uv0;
+	glm::vec2 dv = mesh.uvs[corners[2]] - uv0;
+	glm::vec2 uv = uv0 + u * du + v * dv;
+	glm::vec3 hitX = SolveRay(v0, e1, e2, camera.position, camera.RayDirection(x + 1.5f, y + 0.5f));
+	glm::vec3 hitY = SolveRay(v0, e1, e2, camera.position, camera.RayDirection(x + 0.5f, y + 1.5f));
+	glm::vec2 dx = uv0 + hitX.y * du + hitX.z * dv - uv;
+	glm::vec2 dy = uv0 + hitY.y * du + hitY.z * dv - uv;
+
+	const Texture& texture = (*textures)[id];
+	surface.reflectance *= texture.Sample(uv, texture.Lod(dx, dy));
+	return true;
+}
+
+// Per-frame inputs of the shading pass. At most one of the shadow sources
+// is expected; without either the light is unshadowed.
+struct VisibilityLighting
+{
+	glm::vec3 lightPos;
+	glm::vec3 lightPower;
+	glm::vec3 indirectLight;
+	const CubeShadowMap* shadowMap;
+	const RayScene* shadowScene;	// Shadow rays are traced against it if set
+	const std::vector<Texture>* textures;
+};
+
+// The shading workers write whole clear tiles to the screen at once.
+static_assert(CLEAR_TILE_SIZE % SDL2AUX_CLEAR_TILE_SIZE == 0,
+	"visibility tiles must align with SDL2Aux's clear tiles");
+
+// Shading pass: the point light and constant indirect light of
+// PointLightShader, for every pixel covered in the visibility buffer. Each
+// tile is shaded into a local block and written to the screen in one go,
+// other pixels black, so the screen needs no separate clear.
+inline void ShadeVisibility( const VisibilityBuffer& buffer, const IndexedMesh& mesh, const Camera& camera,
+	const VisibilityLighting& lighting, SDL2Aux* screen, ThreadPool& pool )
+{
+	pool.ParallelFor(buffer.tiles.TileCount(), [&]( int tile )
+	{
+		int x0, y0, x1, y1;
+		buffer.tiles.Bounds(tile, x0, y0, x1, y1);
+		bool drawn = buffer.tiles.Current(tile);
+		glm::vec3 shaded[CLEAR_TILE_SIZE * CLEAR_TILE_SIZE];
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int x = x0; x < x1; ++x)
+			{
+				glm::vec3& color = shaded[(y - y0) * CLEAR_TILE_SIZE + (x - x0)];
+				VisibleSurface surface;
+				if (!drawn || !FetchSurface(buffer, mesh, camera, lighting.textures, x, y, surface))
+				{
+					color = glm::vec3(0.0f);
+					continue;
+				}
+
+				glm::vec3 r = lighting.lightPos - surface.position;
+				float r2 = glm::dot(r, r);
+				float cosine = std::max(glm::dot(r, surface.normal), 0.0f) / std::sqrt(r2);
+				if (cosine > 0 && lighting.shadowMap != NULL)
+					cosine *= lighting.shadowMap->Visibility(surface.position, surface.normal);
+				if (cosine > 0 && lighting.shadowScene != NULL &&
+					lighting.shadowScene->Occluded(surface.position + SHADOW_RAY_OFFSET * surface.normal, lighting.lightPos))
+				{
+					cosine = 0;
+				}
+				glm::vec3 direct = lighting.lightPower * (cosine / (4.0f * 3.14159265359f * r2));
+				color = surface.reflectance * (direct + lighting.indirectLight);
+			}
+		}
+		screen->putTile(x0, y0, x1 - x0, y1 - y0, shaded, CLEAR_TILE_SIZE);
+	});
+}
+
+#endif
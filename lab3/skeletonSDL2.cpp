@@ -2,8 +2,24 @@
 #include <iostream>
 #include <glm/glm.hpp>
 #include "SDL2auxiliary.h"
+#include "SDL2ImageWriter.h"
+#include "SDL2VideoWriter.h"
 #include "TestModel.h"
+#include "FrameArena.h"
+#include "IndexedMesh.h"
+#include "MeshLod.h"
+#include "Meshlets.h"
+#include "CommandBuffer.h"
+#include "Pipeline.h"
+#include "Shaders.h"
+#include "Msaa.h"
+#include "Deferred.h"
+#include "Occlusion.h"
+#include "RayTracer.h"
+#include "VisibilityBuffer.h"
+#include "ThreadPool.h"
 #include <algorithm> //for max()
+#include <cassert>
 
 using namespace std;
 using glm::vec3;
@@ -24,39 +40,65 @@ vec3 cameraPos = vec3(0, 0, -3.001);
 float cameraSpeed = 0.01;
 float yaw = 0;
 mat3 R = mat3(vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1));
-vec3 currentColor;
 float depthBuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+// Clears depthBuffer tile by tile as the forward modes draw into it.
+TileClear depthTiles(SCREEN_WIDTH, SCREEN_HEIGHT);
 vec3 lightPos(0, -0.5, -0.7);
 vec3 lightPower = 1.1f * vec3(1, 1, 1);
 vec3 indirectLight = 0.5f * vec3(1, 1, 1);
-vec3 currentNormal;
-vec3 currentReflectance;
 vec3 indirectLightPowerPerArea = vec3(0.5, 0.5, 0.5);
-
-// ----------------------------------------------------------------------------
-// STRUCT
-struct Pixel
-{
-	int x;
-	int y;
-	float zinv;
-	vec3 illumination;
-	vec3 pos3d;
-};
-
-struct Vertex
+// Scratch memory for the Task 3-5 helpers, reset at the start of every frame.
+FrameArena frameArena(1 << 20);
+IndexedMesh mesh;
+vector<Texture> textures;
+// The test model is tessellated this many times per edge at load, and
+// simplified back per object with distance (level of detail).
+const int MODEL_SUBDIVISIONS = 4;
+LodSelector lodSelector;
+// Coarsest lossless level per object, for views without a camera distance.
+vector<int> exactLods;
+// Culling counters of the last frame's camera pass.
+DrawStats drawStats;
+// The camera pass's draws, recorded once per frame and sorted.
+CommandBuffer commandBuffer;
+// Bump whenever mesh changes so cached light-space data is rebuilt.
+int geometryVersion = 0;
+CubeShadowMap shadowMap(256);
+bool shadowsEnabled = true;
+ThreadPool threadPool;
+GBuffer gbuffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+// Lights for the deferred mode. The first one follows lightPos/lightPower,
+// the rest are small colored lights scattered through the room.
+vector<PointLight> lights;
+const int EXTRA_LIGHTS = 255;
+int activeLights = 1;
+// Low enough that the range window leaves the main light as in forward mode.
+const float MAIN_LIGHT_THRESHOLD = 1.0f / 4096;
+// Anti-aliasing for the forward modes, toggled with M/N.
+MsaaBuffer msaa(SCREEN_WIDTH, SCREEN_HEIGHT, 4);
+bool msaaEnabled = false;
+// Occluder depth pre-pass and object culling, toggled with C/V.
+OcclusionCuller occlusion(SCREEN_WIDTH, SCREEN_HEIGHT);
+bool occlusionEnabled = true;
+// Visibility buffer modes. The hybrid one traces shadow rays against the
+// lossless coarse levels (9/0 toggle them like the shadow map).
+VisibilityBuffer visibilityBuffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+RayScene rayScene;
+// HDR output: the modes write linear light, tone mapped (ACES) with this
+// exposure when the frame is shown. Toggled with H/B, exposure with Z/X.
+bool hdrEnabled = false;
+float exposure = 1;
+
+// Shader combinations selectable at runtime with the number keys.
+enum ShadingMode
 {
-	vec3 position;
-	vec3 normal;
-	vec2 reflectance;
+	SHADING_FLAT = 1,			// Task 5/6: triangle color, depth tested
+	SHADING_PER_PIXEL_LIGHT = 2,	// Task 7: per-pixel point light
+	SHADING_DEFERRED = 3,		// G-buffer pass, then tiled lighting pass
+	SHADING_HYBRID = 4,			// Visibility buffer, then ray-traced shadows
+	SHADING_VISIBILITY = 5		// Visibility buffer, then shadow-mapped light
 };
-
-// Task 7.9
-
-//struct Vertex
-//{
-//	vec3 position;
-//};
+ShadingMode shadingMode = SHADING_PER_PIXEL_LIGHT;
 
 // ----------------------------------------------------------------------------
 // FUNCTIONS
@@ -64,38 +106,117 @@ struct Vertex
 void Update(void);
 void Draw(void);
 void VertexShader(const vec3& v, ivec2& p);
-void Interpolate(ivec2 a, ivec2 b, vector<ivec2>& result);
+void Interpolate(ivec2 a, ivec2 b, const Span<ivec2>& result);
 void DrawLineSDL(ivec2 a, ivec2 b, vec3 color);
-void DrawPolygonEdges(const vector<vec3>& vertices);
-void ComputePolygonRows(const vector<ivec2>& vertexPixels, vector<ivec2>& leftPixels, vector<ivec2>& rightPixels);
-void DrawRows(const vector<ivec2>& leftPixels, const vector<ivec2>& rightPixels);
-void DrawPolygon(const vector<vec3>& vertices);
-// overloading for Task 6
-void VertexShader(const vec3& v, Pixel& p);
-void Interpolate(Pixel a, Pixel b, vector<Pixel>& result);
-void ComputePolygonRows(const vector<Pixel>& vertexPixels, vector<Pixel>& leftPixels, vector<Pixel>& rightPixels);
-void DrawPolygonRows(const vector<Pixel>& leftPixels, const vector<Pixel>& rightPixels);
-void DrawPolygon_new(const vector<vec3>& vertices);
-void DrawLineSDL(Pixel a, Pixel b, vec3 color);
-// Overloading for Task 7
-void PixelShader(const Pixel& p);
-void DrawPolygon(const vector<Vertex>& vertices);
-void VertexShader(const Vertex v, Pixel& p);
-//void DrawPolygonRows(const vector<Pixel>& leftPixels, const vector<Pixel>& rightPixels);
+void DrawPolygonEdges(const Span<vec3>& vertices);
+void ComputePolygonRows(const Span<ivec2>& vertexPixels, Span<ivec2>& leftPixels, Span<ivec2>& rightPixels);
+void DrawPolygonRows(const Span<ivec2>& leftPixels, const Span<ivec2>& rightPixels, vec3 color);
+void DrawPolygon(const Span<vec3>& vertices, vec3 color);
+void CreateLights(void);
+void IgnoreThreadAllocations(const char* name);
+// Tasks 6 and 7 go through the templated pipeline (Pipeline.h, Shaders.h)
 
 int main(int argc, char* argv[])
 {
+	// "--headless N" renders N frames without a window, e.g. for benchmark
+	// runs on a machine without a display. "--capture N" saves every Nth
+	// frame as an image, "--record FILE" streams every frame to FILE: Y4M
+	// video if it ends in .y4m, raw RGBA otherwise. Only one of the two
+	// can be used at a time.
+	int headlessFrames = 0;
+	int captureEvery = 0;
+	const char* recordFile = NULL;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (string(argv[i]) == "--headless")
+			headlessFrames = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "--capture")
+			captureEvery = atoi(argv[i + 1]);
+		else if (string(argv[i]) == "--record")
+			recordFile = argv[i + 1];
+	}
+	if (captureEvery > 0 && recordFile != NULL)
+	{
+		cerr << "--capture and --record cannot be used together." << endl;
+		return 1;
+	}
+	// Recording to standard output ("-") takes it over for the video.
+	if (recordFile != NULL && string(recordFile) == "-")
+		cout.rdbuf(cerr.rdbuf());
+
 	LoadTestModel(triangles);  // Load model
-	sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT);
+	LoadTestTextures(textures);
+	SubdivideTriangles(triangles, MODEL_SUBDIVISIONS);
+	BuildIndexedMesh(triangles, mesh);
+	GenerateLods(mesh);
+	float acmrBefore = AverageCacheMissRatio(mesh, 32);
+	OptimizeVertexCache(mesh);
+	cout << "Indexed mesh: " << mesh.positions.size() << " vertices, " << mesh.TriangleCount()
+		<< " triangles, ACMR " << acmrBefore << " -> " << AverageCacheMissRatio(mesh, 32) << endl;
+	BuildMeshlets(mesh);
+	cout << "Meshlets: " << mesh.meshlets.size() << endl;
+	for (size_t o = 0; o < mesh.objects.size(); ++o)
+	{
+		cout << "Object " << o << " LOD triangles:";
+		for (int l = 0; l < mesh.objects[o].lodCount; ++l)
+			cout << " " << mesh.Lod(o, l).triangleCount << " (" << mesh.Lod(o, l).error << ")";
+		cout << endl;
+		exactLods.push_back(mesh.ExactLod(o));
+	}
+	lodSelector.Init(mesh);
+	occlusion.Build(mesh);
+	commandBuffer.Reserve(mesh);
+	cout << "Occluders: " << occlusion.OccluderCount() << " polygons for " << mesh.objects.size()
+		<< " objects" << endl;
+	rayScene.Build(mesh, &exactLods[0]);
+	cout << "Shadow rays test " << rayScene.TriangleCount() << " triangles" << endl;
+	CreateLights();
+	SDL2Aux::setThreadHook(IgnoreThreadAllocations);
+	if (headlessFrames > 0)
+		sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT, false, SDL2AUX_COPY, SDL2AUX_HEADLESS);
+	else
+	{
+		// Triple buffered, so frames are copied from a pixel buffer;
+		// upload only what changes, as a still camera redraws the same frame.
+		sdlAux = new SDL2Aux(SCREEN_WIDTH, SCREEN_HEIGHT, false, SDL2AUX_COPY, SDL2AUX_MAILBOX, 3);
+		sdlAux->setUpload(SDL2AUX_UPLOAD_CHANGED);
+	}
+	SDL2ImageWriter* imageWriter = NULL;
+	if (captureEvery > 0)
+	{
+		imageWriter = new SDL2ImageWriter();
+		imageWriter->capture(sdlAux, "frame%05d.qoi", SDL2IMAGE_QOI, captureEvery);
+	}
+	SDL2VideoWriter* videoWriter = NULL;
+	if (recordFile != NULL)
+	{
+		string name(recordFile);
+		bool y4m = name.size() > 4 && name.compare(name.size() - 4, 4, ".y4m") == 0;
+		videoWriter = new SDL2VideoWriter(recordFile, y4m ? SDL2VIDEO_Y4M : SDL2VIDEO_RGBA);
+		videoWriter->capture(sdlAux);
+	}
 	t = SDL_GetTicks();	// Set start value for timer.
 
-	while (!sdlAux->quitEvent())
+	for (int frame = 0; !sdlAux->quitEvent() && (headlessFrames == 0 || frame < headlessFrames); ++frame)
 	{
 		Update();
 		Draw();
 	}
 
 	sdlAux->saveBMP("screenshot.bmp");
+	delete sdlAux;	// Stops the present thread
+	if (imageWriter != NULL)
+	{
+		imageWriter->finish();
+		cout << "Captured " << imageWriter->written() << " frames, dropped " << imageWriter->dropped() << endl;
+		delete imageWriter;
+	}
+	if (videoWriter != NULL)
+	{
+		videoWriter->finish();
+		cout << "Recorded " << videoWriter->written() << " frames" << endl;
+		delete videoWriter;
+	}
 	return 0;
 }
 
@@ -108,6 +229,10 @@ void Update(void)
 	float dt = float(t2 - t);
 	t = t2;
 	cout << "Render time: " << dt << " ms." << endl;
+	cout << "Drawn: " << drawStats.objects << " objects, " << drawStats.meshlets - drawStats.offscreenMeshlets -
+		drawStats.backfacingMeshlets << "/" << drawStats.meshlets << " meshlets (" << drawStats.offscreenMeshlets
+		<< " off screen, " << drawStats.backfacingMeshlets << " back-facing), " << drawStats.triangles
+		<< " triangles" << endl;
 
 	const Uint8* keystate = SDL_GetKeyboardState(NULL);
 	if (keystate[SDL_SCANCODE_UP]) {
@@ -144,6 +269,84 @@ void Update(void)
 		float angle = -cameraSpeed * dt;
 		R = R * mat3(cos(angle), 0, sin(angle), 0, 1, 0, -sin(angle), 0, cos(angle));
 	}
+	if (keystate[SDL_SCANCODE_1]) {
+		shadingMode = SHADING_FLAT;
+	}
+	if (keystate[SDL_SCANCODE_2]) {
+		shadingMode = SHADING_PER_PIXEL_LIGHT;
+	}
+	if (keystate[SDL_SCANCODE_3]) {
+		shadingMode = SHADING_DEFERRED;
+	}
+	if (keystate[SDL_SCANCODE_4]) {
+		shadingMode = SHADING_HYBRID;
+	}
+	if (keystate[SDL_SCANCODE_5]) {
+		shadingMode = SHADING_VISIBILITY;
+	}
+	// Deferred mode: T turns on all lights, G goes back to the main light.
+	if (keystate[SDL_SCANCODE_T]) {
+		activeLights = lights.size();
+	}
+	if (keystate[SDL_SCANCODE_G]) {
+		activeLights = 1;
+	}
+
+	// Move the light with IJKL (x/z) and UO (y), toggle shadows with 9/0.
+	float lightStep = 0.001f * dt;
+	if (keystate[SDL_SCANCODE_I]) {
+		lightPos.z += lightStep;
+	}
+	if (keystate[SDL_SCANCODE_K]) {
+		lightPos.z -= lightStep;
+	}
+	if (keystate[SDL_SCANCODE_J]) {
+		lightPos.x -= lightStep;
+	}
+	if (keystate[SDL_SCANCODE_L]) {
+		lightPos.x += lightStep;
+	}
+	if (keystate[SDL_SCANCODE_U]) {
+		lightPos.y -= lightStep;
+	}
+	if (keystate[SDL_SCANCODE_O]) {
+		lightPos.y += lightStep;
+	}
+	if (keystate[SDL_SCANCODE_9]) {
+		shadowsEnabled = true;
+	}
+	if (keystate[SDL_SCANCODE_0]) {
+		shadowsEnabled = false;
+	}
+	if (keystate[SDL_SCANCODE_M]) {
+		msaaEnabled = true;
+	}
+	if (keystate[SDL_SCANCODE_N]) {
+		msaaEnabled = false;
+	}
+	if (keystate[SDL_SCANCODE_C]) {
+		occlusionEnabled = true;
+	}
+	if (keystate[SDL_SCANCODE_V]) {
+		occlusionEnabled = false;
+	}
+	if (keystate[SDL_SCANCODE_Z]) {
+		exposure /= 1 + 0.001f * dt;
+	}
+	if (keystate[SDL_SCANCODE_X]) {
+		exposure *= 1 + 0.001f * dt;
+	}
+	if (keystate[SDL_SCANCODE_H]) {
+		hdrEnabled = true;
+	}
+	if (keystate[SDL_SCANCODE_B]) {
+		hdrEnabled = false;
+	}
+	if (hdrEnabled) {
+		sdlAux->enableHDR(SDL2AUX_ACES, exposure);
+	} else {
+		sdlAux->disableHDR();
+	}
 }
 
 void Draw()
@@ -175,53 +378,125 @@ void Draw()
 	sdlAux->clearPixels();
 	for (int i = 0; i < triangles.size(); ++i)
 	{
-		currentColor = triangles[i].color; //added for task 5
-		vector<vec3> vertices(3);
+		vec3 vertices[3];
 		vertices[0] = triangles[i].v0 * R;
 		vertices[1] = triangles[i].v1 * R;
 		vertices[2] = triangles[i].v2 * R;
-		//DrawPolygonEdges(vertices); //Just for task 4
-		DrawPolygon(vertices); //For task 5 not task 4
+		//DrawPolygonEdges(Span<vec3>(vertices, 3)); //Just for task 4
+		DrawPolygon(Span<vec3>(vertices, 3), triangles[i].color); //For task 5 not task 4
 	}
 	sdlAux->render();
 	*/
 
 	// Task 6 code
-	sdlAux->clearPixels();
-	// init the depth buffer
-	// for (int y = 0; y < SCREEN_HEIGHT; ++y)
-	// {
-	// 	for (int x = 0; x < SCREEN_WIDTH; ++x)
-	// 	{
-	// 		depthBuffer[y][x] = 0;
-	// 	}
-	// }
-
-	// for (int i = 0; i < triangles.size(); ++i)
-	// {
-	// 	currentColor = triangles[i].color;
-	// 	vector<vec3> vertices(3);
-	// 	vertices[0] = triangles[i].v0 * R;
-	// 	vertices[1] = triangles[i].v1 * R;
-	// 	vertices[2] = triangles[i].v2 * R;
-	// 	DrawPolygon_new(vertices);
-	// }
-
-	// Task 7 code
-	
-	for (int i = 0; i < triangles.size(); ++i)
+	frameArena.Reset();
+	// May grow its sample pool, so before the allocation count is taken.
+	bool forward = shadingMode == SHADING_FLAT || shadingMode == SHADING_PER_PIXEL_LIGHT;
+	bool multisampled = msaaEnabled && forward;
+	if (multisampled)
+		msaa.Clear();
+#ifndef NDEBUG
+	size_t allocationsBefore = heapAllocations;
+#endif
+	// The deferred and visibility passes and the MSAA resolve write every
+	// pixel, so only the plain forward modes need the screen cleared.
+	if (forward && !multisampled)
+		sdlAux->clearPixels();
+	depthTiles.Clear();
+
+	// Tasks 6 and 7: each shading mode instantiates its own raster loop.
+	RenderTarget target = { SCREEN_WIDTH, SCREEN_HEIGHT, &depthBuffer[0][0], multisampled ? &msaa : NULL,
+		&depthTiles };
+	ColorOutput output = { sdlAux, target.msaa };
+	Camera camera = { cameraPos, R, focalLength, SCREEN_WIDTH, SCREEN_HEIGHT };
+	// Objects hidden behind the occluders are skipped in every mode, the
+	// others drawn at the level of detail their distance allows.
+	const uint8_t* visible = NULL;
+	if (occlusionEnabled)
+	{
+		occlusion.Cull(camera);
+		visible = occlusion.Visible();
+	}
+	lodSelector.Select(mesh, camera);
+	drawStats.Reset();
+	DrawSelection selection = { visible, lodSelector.Levels(), true, &drawStats };
+	commandBuffer.Reset();
+	commandBuffer.Record(mesh, camera, selection);
+	commandBuffer.Sort();
+	switch (shadingMode)
+	{
+	case SHADING_FLAT:
+	{
+		FlatVertexShader vs;
+		FlatColorShader ps(output);
+		commandBuffer.Execute(camera, vs, ps, target, &drawStats);
+		break;
+	}
+	case SHADING_PER_PIXEL_LIGHT:
+	{
+		// Only re-rendered when the light or the geometry changed.
+		if (shadowsEnabled)
+			shadowMap.Update(mesh, geometryVersion, lightPos, &exactLods[0]);
+
+		// Untextured meshlets skip the texture coordinates.
+		UntexturedVertexShader untexturedVs;
+		WorldPositionVertexShader vs;
+		PointLightShader ps(output, lightPos, lightPower, indirectLightPowerPerArea,
+			shadowsEnabled ? &shadowMap : NULL, &textures);
+		commandBuffer.Execute(camera, untexturedVs, ps, vs, ps, target, &drawStats);
+		break;
+	}
+	case SHADING_DEFERRED:
+	{
+		if (shadowsEnabled)
+			shadowMap.Update(mesh, geometryVersion, lightPos, &exactLods[0]);
+
+		// Geometry pass: surfaces only, overdraw costs no lighting.
+		gbuffer.Clear();
+		RenderTarget gbufferTarget = gbuffer.Target();
+		TexCoordVertexShader vs;
+		GBufferShader ps(&gbuffer, &textures);
+		commandBuffer.Execute(camera, vs, ps, gbufferTarget, &drawStats);
+
+		// Lighting pass: each visible pixel is shaded once.
+		lights[0].position = lightPos;
+		lights[0].power = lightPower;
+		lights[0].range = LightRange(lightPower, MAIN_LIGHT_THRESHOLD);
+		DeferredLighting lighting = { &lights, activeLights, indirectLightPowerPerArea,
+			shadowsEnabled ? &shadowMap : NULL };
+		ShadeDeferred(gbuffer, camera, lighting, sdlAux, threadPool);
+		break;
+	}
+	case SHADING_HYBRID:
+	case SHADING_VISIBILITY:
 	{
-		currentColor = triangles[i].color;
-		currentNormal = triangles[i].normal;
-		currentReflectance = triangles[i].color;
-		vector<Vertex> vertices(3);
-		//Vertex vertices[3];
-		vertices[0].position = triangles[i].v0 * R;
-		vertices[1].position = triangles[i].v1 * R;
-		vertices[2].position = triangles[i].v2 * R;
-		DrawPolygon(vertices);
+		// The raster pass only resolves visibility; in the hybrid mode the
+		// shadows are then traced as rays.
+		bool traced = shadingMode == SHADING_HYBRID;
+		if (shadowsEnabled && !traced)
+			shadowMap.Update(mesh, geometryVersion, lightPos, &exactLods[0]);
+
+		visibilityBuffer.Clear();
+		RenderTarget visibilityTarget = visibilityBuffer.Target();
+		FlatVertexShader vs;
+		VisibilityShader ps(&visibilityBuffer);
+		commandBuffer.Execute(camera, vs, ps, visibilityTarget, &drawStats);
+
+		VisibilityLighting lighting = { lightPos, lightPower, indirectLightPowerPerArea,
+			shadowsEnabled && !traced ? &shadowMap : NULL, shadowsEnabled && traced ? &rayScene : NULL, &textures };
+		ShadeVisibility(visibilityBuffer, mesh, camera, lighting, sdlAux, threadPool);
+		break;
 	}
+	}
+
+	if (multisampled)
+		msaa.Resolve(sdlAux);
 
+#ifndef NDEBUG
+	assert(heapAllocations == allocationsBefore && "raster pipeline allocated from the heap");
+	// The arena's overflow blocks come from malloc, which the count misses.
+	assert(!frameArena.Spilled() && "frame arena overflowed to the heap");
+#endif
 	sdlAux->render();
 
 }
@@ -235,7 +510,7 @@ void VertexShader(const vec3& v, ivec2& p) {
 }
 
 //goes from a to b an fills the result vector with the linear interpolation of doing so
-void Interpolate(ivec2 a, ivec2 b, vector<ivec2>& result)
+void Interpolate(ivec2 a, ivec2 b, const Span<ivec2>& result)
 {
 	int N = result.size();
 	vec2 step = vec2(b - a) / float(max(N - 1, 1));
@@ -255,7 +530,7 @@ void DrawLineSDL(ivec2 a, ivec2 b, vec3 color)
 	int pixels = glm::max(delta.x, delta.y) + 1;
 
 	//get the pixel positions of the line using the interpolation function
-	vector<ivec2> line(pixels);
+	Span<ivec2> line = frameArena.Allocate<ivec2>(pixels);
 	Interpolate(a, b, line);
 
 	//loop through each pixel position and put a pixel there
@@ -265,11 +540,11 @@ void DrawLineSDL(ivec2 a, ivec2 b, vec3 color)
 	}
 }
 
-void DrawPolygonEdges(const vector<vec3>& vertices)
+void DrawPolygonEdges(const Span<vec3>& vertices)
 {
 	int V = vertices.size();
 	//Transform each vertex from 3D world position to 2D image position:
-	vector<ivec2> projectedVertices(V);
+	Span<ivec2> projectedVertices = frameArena.Allocate<ivec2>(V);
 	for (int i = 0; i < V; ++i)
 	{
 		VertexShader(vertices[i], projectedVertices[i]);
@@ -284,7 +559,7 @@ void DrawPolygonEdges(const vector<vec3>& vertices)
 	}
 }
 
-void ComputePolygonRows(const vector<ivec2>& vertexPixels, vector<ivec2>& leftPixels, vector<ivec2>& rightPixels)
+void ComputePolygonRows(const Span<ivec2>& vertexPixels, Span<ivec2>& leftPixels, Span<ivec2>& rightPixels)
 {
 	//Find the max and min y-value of the polygon
 	int maxY = glm::max(glm::max(vertexPixels[0].y, vertexPixels[1].y), vertexPixels[2].y);
@@ -293,9 +568,9 @@ void ComputePolygonRows(const vector<ivec2>& vertexPixels, vector<ivec2>& leftPi
 	//compute the number of rows it occupies (like example 40-10+1=31)
 	int rowAmount = maxY - minY + 1;
 
-	//Resize leftPixels and rightPixels so that they have an element for each row
-	leftPixels.resize(rowAmount);
-	rightPixels.resize(rowAmount);
+	//Allocate leftPixels and rightPixels so that they have an element for each row
+	leftPixels = frameArena.Allocate<ivec2>(rowAmount);
+	rightPixels = frameArena.Allocate<ivec2>(rowAmount);
 
 	//Initialize the x-coordinates in leftPixeks to some really large value and the x-coordiantes in the rightPixels to some really small value
 	for (int i = 0; i < rowAmount; i++)
@@ -323,7 +598,7 @@ void ComputePolygonRows(const vector<ivec2>& vertexPixels, vector<ivec2>& leftPi
 		int pixels = max(delta.x, delta.y) + 1;
 
 		// Interpolate to get the line pixels
-		vector<ivec2> line(pixels);
+		Span<ivec2> line = frameArena.Allocate<ivec2>(pixels);
 		Interpolate(p1, p2, line);
 
 		// Update leftPixels and rightPixels with the values from the interpolated line
@@ -342,231 +617,57 @@ void ComputePolygonRows(const vector<ivec2>& vertexPixels, vector<ivec2>& leftPi
 }
 
 //Calls putPixel for each pixel between the start and end for each row
-void DrawPolygonRows(const vector<ivec2>& leftPixels, const vector<ivec2>& rightPixels)
+void DrawPolygonRows(const Span<ivec2>& leftPixels, const Span<ivec2>& rightPixels, vec3 color)
 {
 	for (int i = 0; i < leftPixels.size(); i++)
 	{
-		DrawLineSDL(leftPixels[i], rightPixels[i], currentColor);
+		DrawLineSDL(leftPixels[i], rightPixels[i], color);
 	}
 }
 
-void DrawPolygon(const vector<vec3>& vertices)
+void DrawPolygon(const Span<vec3>& vertices, vec3 color)
 {
 	int V = vertices.size();
-	vector<ivec2> vertexPixels(V);
+	Span<ivec2> vertexPixels = frameArena.Allocate<ivec2>(V);
 	for (int i = 0; i < V; ++i)
 	{
 		VertexShader(vertices[i], vertexPixels[i]);
 	}
-	vector<ivec2> leftPixels;
-	vector<ivec2> rightPixels;
+	Span<ivec2> leftPixels;
+	Span<ivec2> rightPixels;
 	ComputePolygonRows(vertexPixels, leftPixels, rightPixels);
-	DrawPolygonRows(leftPixels, rightPixels);
-}
-
-
-// ----------------------------------------------------------------------------
-// Below is the function rewritten for Task 6
-
-void VertexShader(const vec3& v, Pixel& p)
-{
-	vec3 pos = (v - cameraPos);
-
-	p.x = focalLength * pos.x / pos.z + SCREEN_WIDTH / 2;
-	p.y = focalLength * pos.y / pos.z + SCREEN_HEIGHT / 2;
-	p.zinv = 1.0 / pos.z;
-}
-
-void Interpolate(Pixel a, Pixel b, vector<Pixel>& result)
-{
-	int N = result.size();
-	float stepX = float(b.x - a.x) / max(N - 1, 1);
-	float stepY = float(b.y - a.y) / max(N - 1, 1);
-	float stepZInv = float(b.zinv - a.zinv) / max(N - 1, 1);
-
-	Pixel current = a;
-
-	for (int i = 0; i < N; ++i)
-	{
-		// Update each variable of pixel and avoid cumulative errors 
-		current.x = a.x + (float)i * stepX;
-		current.y = a.y + (float)i * stepY;
-		current.zinv = a.zinv + (float)i * stepZInv;
-		result[i] = current;
-	}
+	DrawPolygonRows(leftPixels, rightPixels, color);
 }
 
-void ComputePolygonRows(const vector<Pixel>& vertexPixels, vector<Pixel>& leftPixels, vector<Pixel>& rightPixels)
+// Sets up the deferred mode lights: the main light first, then dim
+// colored lights at fixed pseudo-random spots inside the room.
+void CreateLights()
 {
-	int maxY = glm::max(glm::max(vertexPixels[0].y, vertexPixels[1].y), vertexPixels[2].y);
-	int minY = glm::min(glm::min(vertexPixels[0].y, vertexPixels[1].y), vertexPixels[2].y);
-	int rowAmount = maxY - minY + 1;
-	leftPixels.resize(rowAmount);
-	rightPixels.resize(rowAmount);
-	for (int i = 0; i < rowAmount; i++)
-	{
-		leftPixels[i].x = +numeric_limits<int>::max();
-		rightPixels[i].x = -numeric_limits<int>::max();
-
-		leftPixels[i].y = i + minY; //Starts from minimum and increases
-		rightPixels[i].y = i + minY;
-	}
+	lights.clear();
+	PointLight main = { lightPos, lightPower, LightRange(lightPower, MAIN_LIGHT_THRESHOLD), true };
+	lights.push_back(main);
 
-	for (int i = 0; i < vertexPixels.size(); ++i)
+	unsigned seed = 12345;
+	for (int i = 0; i < EXTRA_LIGHTS; ++i)
 	{
-		// convert pixel to ivec2
-		ivec2 p1 = ivec2(vertexPixels[i].x, vertexPixels[i].y);
-		ivec2 p2 = ivec2(vertexPixels[(i + 1) % vertexPixels.size()].x, vertexPixels[(i + 1) % vertexPixels.size()].y);
-		ivec2 delta = glm::abs(p2 - p1);
-		int pixels = max(delta.x, delta.y) + 1;
-		
-		vector<Pixel> line(pixels);
-		
-		Interpolate(vertexPixels[i], vertexPixels[(i + 1) % vertexPixels.size()], line);
-		for (int j = 0; j < line.size(); j++) {
-			for (int k = 0; k < rowAmount; k++) {
-				if (leftPixels[k].y == line[j].y) {
-					if (leftPixels[k].x > line[j].x) {
-						leftPixels[k].x = line[j].x;
-						leftPixels[k].zinv = line[j].zinv;
-					}
-					if (rightPixels[k].x < line[j].x) {
-						rightPixels[k].x = line[j].x;
-						rightPixels[k].zinv = line[j].zinv;
-					}
-					break;
-				}
-			}
+		float r[6];
+		for (int k = 0; k < 6; ++k)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			r[k] = (seed >> 8) / float(1 << 24);
 		}
+		vec3 position = vec3(r[0], r[1], r[2]) * 1.9f - vec3(0.95f);
+		vec3 power = 0.02f * vec3(r[3], r[4], r[5]);
+		PointLight light = { position, power, LightRange(power), false };
+		lights.push_back(light);
 	}
 }
 
-//void DrawLineSDL(Pixel a, Pixel b, vec3 color)
-//{
-//	ivec2 delta;
-//	delta.x = glm::abs(b.x - a.x);
-//	delta.y = glm::abs(b.y - a.y);
-//	int pixels = glm::max(delta.x, delta.y) + 1;
-//
-//	vector<Pixel> line(pixels);
-//	Interpolate(a, b, line);
-//	for (int i = 0; i < pixels; i++)
-//	{
-//		int x = line[i].x;
-//		int y = line[i].y;
-//
-//		// Ensure the pixel is within the screen bounds
-//		if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT)
-//		{
-//			// Render color if closer to camera
-//			if (line[i].zinv > depthBuffer[y][x])
-//			{
-//				// Update depthBuffer with the current closest
-//				depthBuffer[y][x] = line[i].zinv;
-//				sdlAux->putPixel(x, y, currentColor);
-//
-//			}
-//		}
-//	}
-//}
-
-//void DrawPolygonRows(const vector<Pixel>& leftPixels, const vector<Pixel>& rightPixels)
-//{
-//	for (int i = 0; i < leftPixels.size(); ++i)
-//	{
-//		DrawLineSDL(leftPixels[i], rightPixels[i], currentColor);
-//		//DrawLineSDL(ivec2(leftPixels[i].x, leftPixels[i].y), ivec2(rightPixels[i].x, rightPixels[i].y), currentColor);
-//
-//	}
-//};
-
-void DrawPolygon_new(const vector<vec3>& vertices)
+// SDL2Aux's present and resolve threads and the writers run beside the
+// frame, so their allocations are left out of the per-frame count.
+void IgnoreThreadAllocations(const char* /*name*/)
 {
-	int V = vertices.size();
-	vector<Pixel> vertexPixels(V);
-	for (int i = 0; i < V; ++i)
-	{
-		VertexShader(vertices[i], vertexPixels[i]);
-	}
-	vector<Pixel> leftPixels;
-	vector<Pixel> rightPixels;
-	ComputePolygonRows(vertexPixels, leftPixels, rightPixels);
-	DrawPolygonRows(leftPixels, rightPixels);
+#ifndef NDEBUG
+	heapAllocationsIgnored = true;
+#endif
 }
-
-// ----------------------------------------------------------------------------
-// Task 7 (Rewritten Functions)
-
-void PixelShader(const Pixel& p)
-{
-	int x = p.x;
-	int y = p.y;
-	if (p.zinv > depthBuffer[y][x])
-	{
-		depthBuffer[y][x] = p.zinv;
-
-		vec3 n = currentNormal;
-		vec3 r = lightPos - p.pos3d;
-		vec3 rnorm = glm::normalize(r);
-		vec3 D;
-
-		float r_length = glm::length(r);
-
-		D = vec3(lightPower * glm::max(glm::dot(rnorm, n), 0.0f)) / float(4.0f * glm::pow(r_length, 2.0f) * 3.14159265359);
-		vec3 illumination = currentReflectance * (D + currentReflectance);
-		
-		sdlAux->putPixel(x, y, p.illumination);
-	}
-}
-
-void VertexShader(const Vertex v, Pixel& p)
-{
-	vec3 pos = (v.position - cameraPos) * R;
-	p.zinv = 1.0 / pos.z;
-	p.x = focalLength * pos.x / pos.z + SCREEN_WIDTH / 2;
-	p.y = focalLength * pos.y / pos.z + SCREEN_HEIGHT / 2;
-
-	// Calculate illumination
-	vec3 r = glm::normalize(v.position - lightPos);
-	float dot = glm::dot(r, v.normal);
-	float intensity = glm::max(0.0f, dot);
-}
-
-void DrawPolygon(const vector<Vertex>& vertices)
-{
-	int V = vertices.size();
-	vector<Pixel> vertexPixels(V);
-	for (int i = 0; i < V; ++i)
-	{
-		VertexShader(vertices[i], vertexPixels[i]);
-	}
-	vector<Pixel> leftPixels;
-	vector<Pixel> rightPixels;
-	ComputePolygonRows(vertexPixels, leftPixels, rightPixels);
-	DrawPolygonRows(leftPixels, rightPixels);
-}
-
-void DrawPolygonRows(const vector<Pixel>& leftPixels, const vector<Pixel>& rightPixels)
-{
-	for (int i = 0; i < leftPixels.size(); ++i)
-	{
-		DrawLineSDL(leftPixels[i], rightPixels[i], currentColor);
-
-	}
-};
-
-void DrawLineSDL(Pixel a, Pixel b, vec3 color)
-{
-	ivec2 delta;
-	delta.x = glm::abs(b.x - a.x);
-	delta.y = glm::abs(b.y - a.y);
-	int pixels = glm::max(delta.x, delta.y) + 1;
-
-	vector<Pixel> line(pixels);
-	Interpolate(a, b, line);
-	for (int i = 0; i < pixels; i++)
-	{
-		void PixelShader(const Pixel & p);
-
-	}
-}
\ No newline at end of file